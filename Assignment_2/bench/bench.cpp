@@ -0,0 +1,100 @@
+// Timings of the editor on scenes of growing size, without a window: run it from the
+// build directory as ./Assignment2_bench. Every operation is timed per triangle, so a
+// cost that stays flat from one size to the next is linear in the size of the scene.
+// It also guards the click latency on the largest scene: it fails, returning 1, if the
+// median click takes longer than CLICK_BUDGET_US.
+
+#include "Helpers.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using namespace Eigen;
+using Clock = std::chrono::high_resolution_clock;
+
+#include "Editor.h"
+
+#define CLICKS 1000          // Clicks timed on the largest scene.
+#define CLICK_BUDGET_US 50.0 // Median microseconds a click may take there.
+
+// Seconds since start.
+static double since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Append n small triangles spread over [-1,1]^2, as insert_triangle does, then bring the
+// caches up to date. Returns the seconds taken.
+static double insert(Editor& e, int n, std::mt19937& random) {
+	std::uniform_real_distribution<float> place(-1.0f, 1.0f), corner(-1.0f, 1.0f);
+	float size = 2.0f / std::sqrt(float(n));
+	Clock::time_point start = Clock::now();
+	for (int k = 0; k < n; k++) {
+		float x = place(random), y = place(random);
+		float xy[6];
+		for (int j = 0; j < 6; j += 2) {
+			xy[j] = x + corner(random) * size;
+			xy[j + 1] = y + corner(random) * size;
+		}
+		e.groups.add_member(0, e.triangles.push_back(xy, -1.0));
+	}
+	e.sync();
+	return since(start);
+}
+
+// Delete every triangle in random order, as the delete mode does, then bring the caches up
+// to date. Returns the seconds taken.
+static double remove_all(Editor& e, std::mt19937& random) {
+	std::vector<int> slots;
+	for (int t = e.triangles.head; t != -1; t = e.triangles.next[t]) { slots.push_back(t); }
+	std::shuffle(slots.begin(), slots.end(), random);
+	Clock::time_point start = Clock::now();
+	for (size_t k = 0; k < slots.size(); k++) { e.delete_at(slots[k]); }
+	e.sync();
+	return since(start);
+}
+
+// Click n random points as the translation mode does, returns the median and the slowest
+// click in microseconds, and the triangles hit in hits.
+static void click(Editor& e, int n, std::mt19937& random, double* median, double* slowest, int* hits) {
+	std::uniform_real_distribution<float> place(-1.0f, 1.0f);
+	std::vector<double> times;
+	*hits = 0;
+	for (int k = 0; k < n; k++) {
+		Vector2d p(place(random), place(random));
+		Clock::time_point start = Clock::now();
+		if (e.click_on_triangle(p)) { (*hits) ++; }
+		times.push_back(since(start) * 1e6);
+	}
+	std::sort(times.begin(), times.end());
+	*median = times[times.size() / 2];
+	*slowest = times.back();
+}
+
+int main() {
+	const int sizes[] = {10000, 100000, 1000000};
+	std::mt19937 random(1);
+	double median = 0, slowest = 0;
+	int hits = 0;
+	printf("%10s %14s %14s\n", "triangles", "insert ns/tri", "delete ns/tri");
+	for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+		int n = sizes[k];
+		Editor e;
+		e.init();
+		e.delete_at(e.triangles.head); // the triangle of init
+		double inserted = insert(e, n, random);
+		if (k + 1 == sizeof(sizes) / sizeof(sizes[0])) {
+			click(e, CLICKS, random, &median, &slowest, &hits);
+		}
+		double deleted = remove_all(e, random);
+		printf("%10d %14.1f %14.1f\n", n, inserted / n * 1e9, deleted / n * 1e9);
+	}
+	printf("Click at %d triangles: median %.1f us, slowest %.1f us, %d of %d hit.\n", sizes[2], median, slowest, hits, CLICKS);
+	if (median > CLICK_BUDGET_US) {
+		printf("FAILED: the median click is over the budget of %.0f us.\n", CLICK_BUDGET_US);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef AFFINE2_H
+#define AFFINE2_H
+
+#include <Eigen/Core>
+#include <cmath>
+
+// 2D affine transform stored as the column-major 2x3 matrix
+//   | a c x |
+//   | b d y |
+// It is 6 floats, laid out like a GLSL mat3x2 so it can be uploaded with glUniformMatrix3x2fv.
+struct Affine2 {
+	float a, b, c, d, x, y;
+
+	static Affine2 identity(void);
+	static Affine2 translate(float tx, float ty);
+	static Affine2 rotate(float theta);
+	static Affine2 scale(float s);
+	static Affine2 about(const Eigen::Vector2f& pivot, const Affine2& m); // T(pivot) * m * T(-pivot)
+	static Affine2 similarity(const Eigen::Vector2f& pivot, const float* t, const float* r, float k);
+
+	// Inverse of similarity() for transforms made of translation, rotation and uniform scale.
+	void decompose(const Eigen::Vector2f& pivot, float* t, float* r, float* k) const;
+
+	Affine2 operator*(const Affine2& r) const;
+	Eigen::Vector2f operator*(const Eigen::Vector2f& p) const;
+	Affine2 inverse(void) const;
+	Eigen::Matrix4f to_matrix4(void) const;
+	const float* data(void) const { return &a; }
+};
+
+static_assert(sizeof(Affine2) == 6 * sizeof(float), "Affine2 must stay 6 packed floats");
+
+//Implementation
+inline Affine2 Affine2::identity(void) {
+	Affine2 m = {1, 0, 0, 1, 0, 0};
+	return m;
+}
+
+inline Affine2 Affine2::translate(float tx, float ty) {
+	Affine2 m = {1, 0, 0, 1, tx, ty};
+	return m;
+}
+
+inline Affine2 Affine2::rotate(float theta) {
+	Affine2 m = {std::cos(theta), std::sin(theta), -std::sin(theta), std::cos(theta), 0, 0};
+	return m;
+}
+
+inline Affine2 Affine2::scale(float s) {
+	Affine2 m = {s, 0, 0, s, 0, 0};
+	return m;
+}
+
+inline Affine2 Affine2::about(const Eigen::Vector2f& pivot, const Affine2& m) {
+	return translate(pivot(0), pivot(1)) * m * translate(-pivot(0), -pivot(1));
+}
+
+// T(t) * T(pivot) * R * S * T(-pivot), with t = tx,ty, r = cos,sin of the angle and k the scale.
+inline Affine2 Affine2::similarity(const Eigen::Vector2f& pivot, const float* t, const float* r, float k) {
+	Affine2 m = {k * r[0], k * r[1], -k * r[1], k * r[0], 0, 0};
+	m.x = t[0] + pivot(0) - (m.a * pivot(0) + m.c * pivot(1));
+	m.y = t[1] + pivot(1) - (m.b * pivot(0) + m.d * pivot(1));
+	return m;
+}
+
+inline void Affine2::decompose(const Eigen::Vector2f& pivot, float* t, float* r, float* k) const {
+	*k = std::sqrt(a * a + b * b);
+	r[0] = (*k != 0) ? a / *k : 1.0f;
+	r[1] = (*k != 0) ? b / *k : 0.0f;
+	t[0] = x - pivot(0) + (a * pivot(0) + c * pivot(1));
+	t[1] = y - pivot(1) + (b * pivot(0) + d * pivot(1));
+}
+
+inline Affine2 Affine2::operator*(const Affine2& r) const {
+	Affine2 m;
+	m.a = a * r.a + c * r.b;
+	m.b = b * r.a + d * r.b;
+	m.c = a * r.c + c * r.d;
+	m.d = b * r.c + d * r.d;
+	m.x = a * r.x + c * r.y + x;
+	m.y = b * r.x + d * r.y + y;
+	return m;
+}
+
+inline Eigen::Vector2f Affine2::operator*(const Eigen::Vector2f& p) const {
+	return Eigen::Vector2f(a * p(0) + c * p(1) + x, b * p(0) + d * p(1) + y);
+}
+
+inline Affine2 Affine2::inverse(void) const {
+	float det = a * d - b * c;
+	float k = (det != 0) ? 1.0f / det : 0.0f;
+	Affine2 m;
+	m.a = d * k;
+	m.b = -b * k;
+	m.c = -c * k;
+	m.d = a * k;
+	m.x = -(m.a * x + m.c * y);
+	m.y = -(m.b * x + m.d * y);
+	return m;
+}
+
+inline Eigen::Matrix4f Affine2::to_matrix4(void) const {
+	Eigen::Matrix4f m = Eigen::Matrix4f::Identity();
+	m(0,0) = a; m(0,1) = c; m(0,3) = x;
+	m(1,0) = b; m(1,1) = d; m(1,3) = y;
+	return m;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "Affine2.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#define ANIMATION_TYPES 8  // 0: none, 1-7.
+#define ANIMATION_PHASES 4 // The phases are whole numbers and the motion repeats every 4 of them.
+#define PALETTE_COLORS 11  // Color codes -1 to 9.
+
+// The color of each code, at code + 1, in 0-255: drawn by the shaders (see shader_prelude)
+// and written by the exports.
+static const unsigned char PALETTE[PALETTE_COLORS][3] = {{191, 51, 46}, {0, 0, 0}, {240, 128, 128}, {255, 165, 0},
+	{240, 230, 140}, {144, 238, 144}, {102, 205, 170}, {32, 178, 170}, {65, 105, 225}, {123, 104, 238}, {255, 182, 193}};
+
+// The built-in animations, evaluated once per frame for every type and phase instead of
+// once per vertex. A triangle of phase p and type k moves at time t by
+//   p' = motion[k][p mod 4] * (p - pivot) + pivot
+// about its world barycenter, or its model barycenter for type 7, and pulses with
+// pulse[p mod 4] when highlighted. The angle is pi * (t + p), half of it is used, so a
+// phase 4 apart gives the same transform. Out of the animation the clock does not tick,
+// and the pulse is a steady half.
+struct AnimationTable {
+	float pulse[ANIMATION_PHASES];                        // sin of the half angle
+	Affine2 motion[ANIMATION_TYPES][ANIMATION_PHASES];
+
+	void evaluate(float time, bool animated);
+	const Affine2& at(int type, float phase) const { return motion[type][phase_class(phase)]; }
+	static int phase_class(float phase) { return (int)phase & (ANIMATION_PHASES - 1); }
+};
+
+std::string shader_prelude(void);
+
+//Implementation
+// The table at time, with every motion the identity unless animated.
+inline void AnimationTable::evaluate(float time, bool animated) {
+	for (int q = 0; q < ANIMATION_PHASES; q++) {
+		float theta = float(M_PI) * (time + q);
+		float c = std::cos(0.5f * theta);
+		float s = std::sin(0.5f * theta);
+		pulse[q] = animated ? s : 0.5f;
+		for (int k = 0; k < ANIMATION_TYPES; k++) { motion[k][q] = Affine2::identity(); }
+		if (!animated) { continue; }
+		Affine2 spin = {c, -s, s, c, 0, 0};
+		Affine2 flip_x = {c, 0, 0, 1, 0, 0}; // a turn about the y axis, seen from the front
+		Affine2 flip_y = {1, 0, 0, c, 0, 0};
+		motion[1][q] = spin;
+		motion[2][q] = flip_x;
+		motion[3][q] = flip_y;
+		motion[4][q] = Affine2::translate(s, 0);
+		motion[5][q] = Affine2::translate(0, s);
+		motion[6][q] = Affine2::scale(1 + s / 2);
+		motion[7][q] = spin;
+	}
+}
+
+// The GLSL the vertex shaders share, inserted after their #version line (see Program::prelude),
+// so that it is written once: the palette, as vec3 palette[PALETTE_COLORS], and the std140
+// Frame block uploaded once per frame (FrameBlock in main.cpp). Its motion holds the table
+// evaluated for the frame: the 2x2 part then the translation of type k at phase q in
+// entries (k * ANIMATION_PHASES + q) * 2 and + 1.
+inline std::string shader_prelude(void) {
+	char buff[200];
+	snprintf(buff, sizeof(buff), "const vec3 palette[%d] = vec3[%d](", PALETTE_COLORS, PALETTE_COLORS);
+	std::string glsl = buff;
+	for (int k = 0; k < PALETTE_COLORS; k++) {
+		snprintf(buff, sizeof(buff), "%svec3(%d,%d,%d)/255.0", k ? ", " : "", PALETTE[k][0], PALETTE[k][1], PALETTE[k][2]);
+		glsl += buff;
+	}
+	snprintf(buff, sizeof(buff), ");\nlayout(std140) uniform Frame {\n\tmat4 view;\n\tfloat time;\n\tint animated;\n"
+		"\tvec4 pulse;\n\tvec4 motion[%d];\n};\n", ANIMATION_TYPES * ANIMATION_PHASES * 2);
+	return glsl + buff;
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef BOUNDS_TREE_H
+#define BOUNDS_TREE_H
+
+#include <vector>
+#include <algorithm>
+
+#define BOUNDS_MARGIN 0.02f // Leaves are fattened by this much at most, so small moves keep the tree as is,
+#define BOUNDS_FATTEN 0.25f // and by this fraction of their size: small boxes stay small in a dense scene.
+
+// Dynamic bounding volume hierarchy over the world space boxes of the triangle slots.
+// Every live slot is a leaf holding a fattened box. A slot that moves inside its fat box
+// costs nothing; one that leaves it is refit: its leaf box is replaced and the boxes of its
+// ancestors are recomputed up to the root, with no change to the structure. The tree is
+// rebuilt top-down, splitting at the median, once the refits since the last build reach
+// the number of leaves, so the cost of keeping it tight is O(log N) amortized per refit.
+// Inserts pick the sibling that grows the least and rotations keep the tree balanced.
+// A large batch of moves refits each ancestor once, instead of a walk to the root per slot.
+class BoundsTree {
+	public:
+		int root;      // -1 if empty.
+		int leaves;    // Numbers of live slots.
+		int refits;    // Refits since the last build.
+		int free_head; // First free node, chained through child[0].
+
+		std::vector<float> box;    // xmin,ymin,xmax,ymax. 4 floats per node.
+		std::vector<int> parent;
+		std::vector<int> child;    // 2 per node, -1 for leaves.
+		std::vector<int> height;   // 0 for leaves.
+		std::vector<int> slot;     // Triangle slot of a leaf.
+		std::vector<int> leaf;     // Leaf node of each triangle slot, -1 if none.
+
+	void init(void);
+	void insert(int s, const float* b);
+	void remove(int s);
+	void move(int s, const float* b);
+	void move_many(const std::vector<int>& slots, const float* boxes);
+	void set(int s, const float* b);
+	void unset(int s);
+	void build(void);
+	void query(const float* b, std::vector<int>& out) const;
+
+	private:
+	int allocate(void);
+	void release(int n);
+	void insert_leaf(int n);
+	void remove_leaf(int n);
+	void refit_up(int n);
+	void fatten(int n, const float* b);
+	int rotate(int a);
+	int build_range(int* nodes, int count);
+	float* node_box(int n) { return &box[n * 4]; }
+	const float* node_box(int n) const { return &box[n * 4]; }
+};
+
+//Implementation
+namespace bounds {
+
+inline float area(const float* b) { return (b[2] - b[0]) * (b[3] - b[1]); }
+
+inline void unite(const float* a, const float* b, float* out) {
+	out[0] = std::min(a[0], b[0]);
+	out[1] = std::min(a[1], b[1]);
+	out[2] = std::max(a[2], b[2]);
+	out[3] = std::max(a[3], b[3]);
+}
+
+inline bool contains(const float* outer, const float* inner) {
+	return outer[0] <= inner[0] && outer[1] <= inner[1] && outer[2] >= inner[2] && outer[3] >= inner[3];
+}
+
+inline bool overlaps(const float* a, const float* b) {
+	return a[0] <= b[2] && a[1] <= b[3] && b[0] <= a[2] && b[1] <= a[3];
+}
+
+}
+
+inline void BoundsTree::init(void) {
+	root = free_head = -1;
+	leaves = refits = 0;
+	box.clear();
+	parent.clear();
+	child.clear();
+	height.clear();
+	slot.clear();
+	leaf.clear();
+}
+
+inline int BoundsTree::allocate(void) {
+	int n = free_head;
+	if (n != -1) { free_head = child[n * 2]; }
+	else {
+		n = (int)parent.size();
+		box.resize(box.size() + 4);
+		parent.push_back(-1);
+		child.resize(child.size() + 2);
+		height.push_back(0);
+		slot.push_back(-1);
+	}
+	parent[n] = -1;
+	child[n * 2] = child[n * 2 + 1] = -1;
+	height[n] = 0;
+	slot[n] = -1;
+	return n;
+}
+
+inline void BoundsTree::release(int n) {
+	height[n] = -1;
+	child[n * 2] = free_head;
+	free_head = n;
+}
+
+// Add slot s with the world box b.
+inline void BoundsTree::insert(int s, const float* b) {
+	if (s >= (int)leaf.size()) { leaf.resize(std::max(s + 1, (int)leaf.size() * 2), -1); }
+	int n = allocate();
+	fatten(n, b);
+	slot[n] = s;
+	leaf[s] = n;
+	leaves ++;
+	insert_leaf(n);
+}
+
+inline void BoundsTree::remove(int s) {
+	if (s >= (int)leaf.size() || leaf[s] == -1) { return; }
+	remove_leaf(leaf[s]);
+	release(leaf[s]);
+	leaf[s] = -1;
+	leaves --;
+}
+
+// Slot s now has the world box b. Inserted if it is not in the tree yet.
+inline void BoundsTree::move(int s, const float* b) {
+	if (s >= (int)leaf.size() || leaf[s] == -1) {
+		insert(s, b);
+		return;
+	}
+	int n = leaf[s];
+	if (bounds::contains(node_box(n), b)) { return; }
+	fatten(n, b);
+	refit_up(parent[n]);
+	if (++ refits >= leaves) { build(); }
+}
+
+// Slot s now has the box boxes + s * 4, for every s of slots. The leaves that left their fat
+// box are refit, then their ancestors, each once and the lowest first, without rotations.
+inline void BoundsTree::move_many(const std::vector<int>& slots, const float* boxes) {
+	std::vector<char> queued(parent.size(), 0);
+	std::vector<std::vector<int> > levels; // the ancestors to refit, by height
+	std::vector<int> inserted;
+	for (size_t k = 0; k < slots.size(); k++) {
+		int s = slots[k];
+		const float* b = boxes + (size_t)s * 4;
+		if (s >= (int)leaf.size() || leaf[s] == -1) { // after the refits, which it would rotate
+			inserted.push_back(s);
+			continue;
+		}
+		int n = leaf[s];
+		if (bounds::contains(node_box(n), b)) { continue; }
+		fatten(n, b);
+		refits ++;
+		for (int p = parent[n]; p != -1 && !queued[p]; p = parent[p]) {
+			queued[p] = 1;
+			if (height[p] >= (int)levels.size()) { levels.resize(height[p] + 1); }
+			levels[height[p]].push_back(p);
+		}
+	}
+	for (size_t h = 1; h < levels.size(); h++) {
+		for (size_t k = 0; k < levels[h].size(); k++) {
+			int n = levels[h][k];
+			bounds::unite(node_box(child[n * 2]), node_box(child[n * 2 + 1]), node_box(n));
+		}
+	}
+	for (size_t k = 0; k < inserted.size(); k++) { insert(inserted[k], boxes + (size_t)inserted[k] * 4); }
+	if (refits >= leaves) { build(); }
+}
+
+// Bulk edits: set gives slot s the box b and unset drops it, both without touching the
+// internal nodes, which are stale until the next build.
+inline void BoundsTree::set(int s, const float* b) {
+	if (s >= (int)leaf.size()) { leaf.resize(std::max(s + 1, (int)leaf.size() * 2), -1); }
+	if (leaf[s] == -1) {
+		leaf[s] = allocate();
+		slot[leaf[s]] = s;
+		leaves ++;
+	}
+	fatten(leaf[s], b);
+}
+
+inline void BoundsTree::unset(int s) {
+	if (s >= (int)leaf.size() || leaf[s] == -1) { return; }
+	release(leaf[s]);
+	leaf[s] = -1;
+	leaves --;
+}
+
+inline void BoundsTree::fatten(int n, const float* b) {
+	float* fat = node_box(n);
+	float margin = std::min(BOUNDS_MARGIN, BOUNDS_FATTEN * std::max(b[2] - b[0], b[3] - b[1]));
+	fat[0] = b[0] - margin; fat[1] = b[1] - margin;
+	fat[2] = b[2] + margin; fat[3] = b[3] + margin;
+}
+
+// Append to out the slots whose fat box overlaps b. A point query is a degenerate box.
+inline void BoundsTree::query(const float* b, std::vector<int>& out) const {
+	if (root == -1) { return; }
+	int stack[64];          // enough for a balanced tree; a deeper one spills to the heap
+	std::vector<int> spill; // the nodes pushed on a full stack, popped first
+	int top = 0;
+	stack[top ++] = root;
+	while (top > 0 || !spill.empty()) {
+		int n;
+		if (!spill.empty()) {
+			n = spill.back();
+			spill.pop_back();
+		} else { n = stack[-- top]; }
+		if (!bounds::overlaps(node_box(n), b)) { continue; }
+		if (height[n] == 0) {
+			out.push_back(slot[n]);
+			continue;
+		}
+		for (int k = 0; k < 2; k++) {
+			if (top < 64) { stack[top ++] = child[n * 2 + k]; }
+			else { spill.push_back(child[n * 2 + k]); }
+		}
+	}
+}
+
+// Rebuild the whole tree from its leaves, splitting the longer side at the median center.
+inline void BoundsTree::build(void) {
+	std::vector<int> nodes;
+	nodes.reserve(leaves);
+	for (int n = 0; n < (int)parent.size(); n++) {
+		if (height[n] == 0 && slot[n] != -1) { nodes.push_back(n); }
+		else if (height[n] > 0) { release(n); }
+	}
+	root = nodes.empty() ? -1 : build_range(nodes.data(), (int)nodes.size());
+	if (root != -1) { parent[root] = -1; }
+	refits = 0;
+}
+
+inline int BoundsTree::build_range(int* nodes, int count) {
+	if (count == 1) { return nodes[0]; }
+	float b[4];
+	std::copy(node_box(nodes[0]), node_box(nodes[0]) + 4, b);
+	for (int k = 1; k < count; k++) { bounds::unite(b, node_box(nodes[k]), b); }
+	int axis = (b[2] - b[0]) >= (b[3] - b[1]) ? 0 : 1;
+	int half = count / 2;
+	std::nth_element(nodes, nodes + half, nodes + count, [this, axis](int p, int q) {
+		return box[p * 4 + axis] + box[p * 4 + axis + 2] < box[q * 4 + axis] + box[q * 4 + axis + 2];
+	});
+	int l = build_range(nodes, half);
+	int r = build_range(nodes + half, count - half);
+	int n = allocate();
+	child[n * 2] = l;
+	child[n * 2 + 1] = r;
+	parent[l] = parent[r] = n;
+	height[n] = 1 + std::max(height[l], height[r]);
+	std::copy(b, b + 4, node_box(n));
+	return n;
+}
+
+// Pair leaf n with the node that grows the least, by area, and refit its ancestors.
+inline void BoundsTree::insert_leaf(int n) {
+	if (root == -1) {
+		root = n;
+		parent[n] = -1;
+		return;
+	}
+	float b[4]; // copied, allocate may move the boxes
+	std::copy(node_box(n), node_box(n) + 4, b);
+	int s = root;
+	while (height[s] > 0) {
+		int c0 = child[s * 2], c1 = child[s * 2 + 1];
+		float u[4];
+		bounds::unite(node_box(s), b, u);
+		float combined = bounds::area(u);
+		float here = 2 * combined;                                     // pair with s itself
+		float inherited = 2 * (combined - bounds::area(node_box(s)));  // paid by going down
+		float cost[2];
+		for (int k = 0; k < 2; k++) {
+			int c = k == 0 ? c0 : c1;
+			bounds::unite(node_box(c), b, u);
+			cost[k] = bounds::area(u) + inherited - (height[c] > 0 ? bounds::area(node_box(c)) : 0);
+		}
+		if (here < cost[0] && here < cost[1]) { break; }
+		s = cost[0] < cost[1] ? c0 : c1;
+	}
+
+	int old_parent = parent[s];
+	int p = allocate();
+	parent[p] = old_parent;
+	bounds::unite(node_box(s), b, node_box(p));
+	height[p] = height[s] + 1;
+	child[p * 2] = s;
+	child[p * 2 + 1] = n;
+	parent[s] = parent[n] = p;
+	if (old_parent == -1) { root = p; }
+	else { child[old_parent * 2 + (child[old_parent * 2] == s ? 0 : 1)] = p; }
+	refit_up(parent[n]);
+}
+
+// Unlink leaf n, its sibling taking the place of their parent.
+inline void BoundsTree::remove_leaf(int n) {
+	if (n == root) {
+		root = -1;
+		return;
+	}
+	int p = parent[n];
+	int g = parent[p];
+	int sibling = child[p * 2] == n ? child[p * 2 + 1] : child[p * 2];
+	release(p);
+	parent[sibling] = g;
+	if (g == -1) { root = sibling; }
+	else {
+		child[g * 2 + (child[g * 2] == p ? 0 : 1)] = sibling;
+		refit_up(g);
+	}
+}
+
+// Recompute the boxes and heights from n up to the root, rotating unbalanced nodes.
+inline void BoundsTree::refit_up(int n) {
+	while (n != -1) {
+		n = rotate(n);
+		int l = child[n * 2], r = child[n * 2 + 1];
+		height[n] = 1 + std::max(height[l], height[r]);
+		bounds::unite(node_box(l), node_box(r), node_box(n));
+		n = parent[n];
+	}
+}
+
+// If the children of a differ in height by more than one, lift the grandchild of the taller
+// side into a's place. Returns the node now at a's position.
+inline int BoundsTree::rotate(int a) {
+	if (height[a] < 2) { return a; }
+	int b = child[a * 2], c = child[a * 2 + 1];
+	int balance = height[c] - height[b];
+	if (balance >= -1 && balance <= 1) { return a; }
+	int up = balance > 1 ? c : b;    // taller child, moved up
+	int down = balance > 1 ? b : c;  // shorter child, stays under a
+	int f = child[up * 2], g = child[up * 2 + 1];
+
+	child[up * 2] = a;
+	parent[up] = parent[a];
+	parent[a] = up;
+	if (parent[up] == -1) { root = up; }
+	else { child[parent[up] * 2 + (child[parent[up] * 2] == a ? 0 : 1)] = up; }
+
+	int keep = height[f] > height[g] ? f : g; // stays under up
+	int give = keep == f ? g : f;             // goes under a
+	child[up * 2 + 1] = keep;
+	child[a * 2] = down;
+	child[a * 2 + 1] = give;
+	parent[give] = a;
+	height[a] = 1 + std::max(height[down], height[give]);
+	bounds::unite(node_box(down), node_box(give), node_box(a));
+	height[up] = 1 + std::max(height[a], height[keep]);
+	bounds::unite(node_box(a), node_box(keep), node_box(up));
+	return up;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "Picking.h"
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#define CULL_OUTSIDE 0 // The box of the triangle misses the visible rectangle.
+#define CULL_DRAWN 1   // Visible, drawn.
+#define CULL_MERGED 2  // Visible but smaller than a pixel, drawn as a part of the cluster of its pixel.
+
+// The triangles a frame has to draw. The visible world rectangle comes from view.inverse(),
+// and the bounds tree of a TrianglePicker gives the triangles whose box meets it. When zoomed
+// out, the triangles smaller than a pixel are gathered in clusters, one per pixel of the
+// window. A pixel holding one of them draws it; a pixel holding more draws their cluster
+// instead, one square for all of them (see publish_clusters in main.cpp), with the color of
+// each weighted by the area it covers. So the count drawn is bounded by what is visible,
+// and by the pixels of the window, and every small triangle still shows in its pixel.
+// The result is kept until the still scene changes (the picker still_version), the view or
+// the window size: the triangles that move are drawn whatever it says.
+class ViewCuller {
+	public:
+		int width, height;
+		Eigen::Matrix4f view;     // View the state was computed with.
+		unsigned version;         // Picker still_version it was computed from.
+		bool valid;
+		float rect[4];            // xmin,ymin,xmax,ymax of the visible world rectangle.
+		std::vector<int> visible; // Slots whose box meets rect, in no particular order.
+		std::vector<char> state;  // CULL_* of each slot.
+		std::vector<int> cell;    // Slot of the small triangle of each pixel, -2 - its cluster if more, -1 if none.
+		std::vector<int> cluster_cell;  // Pixel py * width + px of each cluster.
+		std::vector<int> cluster_first; // Members of cluster k: cluster_slots[cluster_first[k], cluster_first[k + 1]).
+		std::vector<int> cluster_slots;
+		int drawn, merged;        // Counts of the last update: the clusters count as drawn.
+
+	void init(void);
+	void invalidate(void);
+	bool update(const TrianglePicker& picker, const Eigen::Matrix4f& v, int w, int h);
+	int at(int t) const { return t < (int)state.size() ? state[t] : CULL_OUTSIDE; }
+};
+
+//Implementation
+inline void ViewCuller::init(void) {
+	width = height = 0;
+	view.setIdentity();
+	version = 0;
+	valid = false;
+	visible.clear();
+	state.clear();
+	cell.clear();
+	cluster_cell.clear();
+	cluster_first.assign(1, 0);
+	cluster_slots.clear();
+	drawn = merged = 0;
+}
+
+inline void ViewCuller::invalidate(void) {
+	valid = false;
+}
+
+// Bring the state up to date for a w x h window seen through v. Returns whether it changed.
+// The picker must be up to date (see TrianglePicker::update).
+inline bool ViewCuller::update(const TrianglePicker& picker, const Eigen::Matrix4f& v, int w, int h) {
+	if (valid && w == width && h == height && v == view && picker.still_version == version) { return false; }
+	width = w;
+	height = h;
+	view = v;
+	version = picker.still_version;
+	valid = true;
+
+	Eigen::Matrix4f inverse = view.inverse();
+	rect[0] = rect[1] = 1e30f;
+	rect[2] = rect[3] = -1e30f;
+	for (int k = 0; k < 4; k++) { // the corners of the window
+		Eigen::Vector4f c = inverse * Eigen::Vector4f((k & 1) ? 1 : -1, (k & 2) ? 1 : -1, 0, 1);
+		rect[0] = std::min(rect[0], c(0)); rect[1] = std::min(rect[1], c(1));
+		rect[2] = std::max(rect[2], c(0)); rect[3] = std::max(rect[3], c(1));
+	}
+	for (size_t k = 0; k < visible.size(); k++) {
+		if (visible[k] < (int)state.size()) { state[visible[k]] = CULL_OUTSIDE; }
+	}
+	visible.clear();
+	picker.tree.query(rect, visible);
+	state.resize(picker.capacity, CULL_OUTSIDE);
+	cell.resize((size_t)std::max(width, 0) * std::max(height, 0), -1);
+
+	float pixel_w = (rect[2] - rect[0]) / std::max(width, 1);
+	float pixel_h = (rect[3] - rect[1]) / std::max(height, 1);
+	drawn = merged = 0;
+	cluster_cell.clear();
+	std::vector<int> used;    // cells to clear
+	std::vector<int> members; // cluster,slot of every merged triangle
+	for (size_t k = 0; k < visible.size(); k++) {
+		int t = visible[k];
+		const float* b = &picker.box[t * 4];
+		state[t] = CULL_DRAWN;
+		drawn ++;
+		if (picker.moving(t) || b[2] - b[0] >= pixel_w || b[3] - b[1] >= pixel_h) { continue; } // a moving one covers no fixed pixel
+		int px = (int)std::floor(((b[0] + b[2]) * 0.5f - rect[0]) / pixel_w);
+		int py = (int)std::floor(((b[1] + b[3]) * 0.5f - rect[1]) / pixel_h);
+		if (px < 0 || py < 0 || px >= width || py >= height) { continue; }
+		int c = py * width + px;
+		if (cell[c] == -1) { // alone so far, drawn
+			cell[c] = t;
+			used.push_back(c);
+			continue;
+		}
+		if (cell[c] >= 0) { // the second one: the first joins a new cluster
+			int first = cell[c];
+			cell[c] = -2 - (int)cluster_cell.size();
+			members.push_back(-2 - cell[c]);
+			members.push_back(first);
+			cluster_cell.push_back(c);
+			state[first] = CULL_MERGED;
+			drawn --;
+			merged ++;
+		}
+		members.push_back(-2 - cell[c]);
+		members.push_back(t);
+		state[t] = CULL_MERGED;
+		drawn --;
+		merged ++;
+	}
+	int n = (int)cluster_cell.size(); // members by cluster, counting sort
+	cluster_first.assign(n + 1, 0);
+	for (size_t k = 0; k < members.size(); k += 2) { cluster_first[members[k] + 1] ++; }
+	for (int k = 0; k < n; k++) { cluster_first[k + 1] += cluster_first[k]; }
+	cluster_slots.resize(members.size() / 2);
+	std::vector<int> fill(cluster_first.begin(), cluster_first.end() - 1);
+	for (size_t k = 0; k < members.size(); k += 2) { cluster_slots[fill[members[k]] ++] = members[k + 1]; }
+	drawn += n;
+	for (size_t k = 0; k < used.size(); k++) { cell[used[k]] = -1; }
+	return true;
+}
+
+#endif
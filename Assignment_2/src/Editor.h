@@ -2,6 +2,15 @@
 #define EDITOR_H
 
 #include "Helpers.h"
+#include "Affine2.h"
+#include "Groups.h"
+#include "Shapes.h"
+#include "Picking.h"
+#include "PointGrid.h"
+#include "IdBuffer.h"
+#include "Selection.h"
+#include "Timeline.h"
+#include "read_off.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -18,6 +27,8 @@
 #include <iostream>
 #include <algorithm>
 #include <initializer_list>
+#include <vector>
+#include <unordered_map>
 
 #define INSERT_MODE 1
 #define TRANSLATION_MODE 2
@@ -27,53 +38,624 @@
 #define BEZIER_CURVE_MODE 6
 #define QUIT_MODE 7
 
+#define COMPOSE_LANES 8 // Triangles composed together by TriangleStore::compose_dirty.
+#define WELD_CELL 0.01f // Cell size of the welding grid, the largest usable weld tolerance.
+#define PAGE_TRIANGLES 65536                // Triangle slots per page of the GPU storage.
+#define PAGE_VERTICES (3 * PAGE_TRIANGLES)  // Vertex slots per page, enough for its triangles unwelded.
+#define DRAW_ORDER_SPAN (1 << 22) // Draw order keys in use before they are numbered again, see TriangleStore::renumber.
+#define SVG_MOTION_KEYS 32 // Keys of a SMIL animation over its 4 seconds, see Editor::svg_motions.
+
+// Stable reference to a triangle. It stays valid until that triangle is deleted,
+// after which valid() reports false even if the slot has been reused.
+struct TriangleHandle {
+	int slot;
+	unsigned generation;
+};
+
+// Structure-of-arrays storage for the scene triangles. Each field lives in its own
+// contiguous array and the capacity doubles on growth, so inserts are amortized O(1).
+// A transform is kept as its parameters (translation, rotation, uniform scale about the
+// barycenter) and the composed model matrix is cached as a 2x3 affine.
+//
+// Triangles are addressed by slot, a slot map: a deleted slot goes on a free list and is
+// reused by the next insert, nothing is moved, and a generation counter per slot tells
+// stale handles apart. Draw order is a doubly linked list through the slots, and order
+// gives every triangle a key that grows towards the top, to compare two of them in O(1).
+//
+// The triangles whose world geometry changed are journaled in moved_list, which
+// Editor::sync drains into the caches built on the scene (picking). Those, and every other
+// triangle whose drawing data changed (see pack_slot in main.cpp), are journaled in
+// redrawn_list for the renderer. The writes to the vertex pool and to the corner indices
+// are journaled too, in vertex_edits and index_edits, so only those parts of the GPU
+// buffers are uploaded again.
+//
+// Vertices are indexed: triangles hold three indices into a pool of unique vertices, and
+// corners closer than weld_tolerance are welded into one shared vertex on insert. Vertices are
+// in model space, so only the triangles at rest (identity model, not grouped) weld: one that
+// gets a transform or a group is detached, its corners copied out of the shared vertices.
+//
+// Both are split in pages, PAGE_TRIANGLES triangle slots and PAGE_VERTICES vertex slots:
+// the corners of a triangle of page p are vertices of page p, so a page is drawn on its own
+// and the GPU keeps one set of buffers per page (see PagedBuffer). Welding stays in a page.
+class TriangleStore {
+	public:
+		int count;    // Numbers of live triangles in the store.
+		int slots;    // Numbers of slots in use or on the free list. Slots >= slots are untouched.
+		int capacity; // Numbers of slots the arrays can hold before reallocating.
+		int head;     // First triangle in draw order (bottom), -1 if empty.
+		int tail;     // Last triangle in draw order (top), -1 if empty.
+		int free_head; // First free slot, chained through next.
+		unsigned next_order; // Draw order key of the next inserted triangle.
+		int vertex_count;    // Numbers of live unique vertices.
+		int vertex_slots;    // One past the last vertex slot ever used, over all the pages.
+		int vertex_capacity;
+		float weld_tolerance; // Corners closer than this share a vertex, at most WELD_CELL.
+
+		std::vector<float> position;    // x,y of the unique vertices. 2 floats per vertex.
+		std::vector<float> color;       // Color code of the unique vertices. 1 float per vertex.
+		std::vector<int> refs;          // Numbers of corners using the vertex, 0 if it is free.
+		std::vector<std::vector<int> > vertex_free; // Free vertex slots of each page.
+		std::vector<int> vertex_used;   // Vertex slots used or freed in each page.
+		std::vector<int> page_count;    // Live triangles in each page.
+		std::vector<int> emptied;       // Pages whose last triangle was removed since the last upload.
+		std::unordered_multimap<long long, int> weld_grid; // Welding cell -> vertices in it.
+		std::vector<char> welded;       // The vertex is in weld_grid: all its corners are of triangles at rest.
+		std::vector<int> vertex_edits;  // Vertices whose position or color was written since the last upload.
+		std::vector<unsigned> index;    // Vertex of the three corners. 3 per triangle.
+		std::vector<int> index_edits;   // Triangles whose corners were written since the last upload.
+		std::vector<float> animation;   // Animation type (0: none, 1-7). 1 float per triangle.
+		std::vector<float> translation; // tx,ty. 2 floats per triangle.
+		std::vector<float> rotation;    // cos,sin of the rotation angle. 2 floats per triangle.
+		std::vector<float> scaling;     // Uniform scale factor. 1 float per triangle.
+		std::vector<Affine2> model;     // model = translation * rotation * scaling, cached.
+		std::vector<int> group;         // Innermost group holding the triangle (0: not grouped).
+		std::vector<char> dirty;        // The cached model is out of date.
+		std::vector<int> dirty_list;    // Triangles to be composed by compose_dirty.
+		std::vector<char> alive;        // The slot holds a triangle.
+		std::vector<unsigned> generation; // Bumped every time the slot is freed.
+		std::vector<int> next;          // Next triangle in draw order, or next free slot.
+		std::vector<int> prev;          // Previous triangle in draw order.
+		std::vector<unsigned> order;    // Draw order key, higher is drawn later. 0 for a free slot.
+		std::vector<char> moved;        // The world geometry changed since moved_list was drained.
+		std::vector<int> moved_list;
+		std::vector<char> redrawn;      // The drawing data changed since redrawn_list was drained.
+		std::vector<int> redrawn_list;
+
+	void init(void);
+	void reserve(int n);
+	void reserve_vertices(int n);
+	int push_back(const float* xy, float c);
+	void remove(int i);
+	void clear(void);
+	void mark_dirty(int i);
+	void mark_moved(int i);
+	void mark_redrawn(int i);
+	void renumber(void);
+	void compose_dirty(void);
+	void set_model(int i, const Affine2& m);
+	TriangleHandle handle(int i) const;
+	bool valid(TriangleHandle h) const;
+	int resolve(TriangleHandle h) const;
+	Eigen::Vector2f vertex(int i, int k) const;
+	Eigen::Vector2f barycenter(int i) const;
+	float corner_color(int i, int k) const;
+	void set_corner_color(int i, int k, float c);
+	int weld(float x, float y, float c, int page);
+	int new_vertex(float x, float y, float c, int page);
+	bool at_rest(int i) const;
+	void detach(int i);
+	void set_group(int i, int g);
+	void release_vertex(int v);
+	void move_vertex(int v, float x, float y);
+	void unweld(int v);
+	long long weld_key(float x, float y, int dx, int dy) const;
+};
+
+inline void TriangleStore::init(void) {
+	count = 0;
+	slots = 0;
+	capacity = 0;
+	head = tail = free_head = -1;
+	next_order = 1;
+	vertex_count = vertex_slots = vertex_capacity = 0;
+	weld_tolerance = 0.0;
+	position.clear();
+	color.clear();
+	refs.clear();
+	welded.clear();
+	vertex_free.clear();
+	vertex_used.clear();
+	page_count.clear();
+	emptied.clear();
+	weld_grid.clear();
+	vertex_edits.clear();
+	index.clear();
+	index_edits.clear();
+	animation.clear();
+	translation.clear();
+	rotation.clear();
+	scaling.clear();
+	model.clear();
+	group.clear();
+	dirty.clear();
+	dirty_list.clear();
+	alive.clear();
+	generation.clear();
+	next.clear();
+	prev.clear();
+	order.clear();
+	moved.clear();
+	moved_list.clear();
+	redrawn.clear();
+	redrawn_list.clear();
+	reserve(64);
+	reserve_vertices(192);
+}
+
+inline void TriangleStore::reserve(int n) {
+	if (n <= capacity) { return; }
+	capacity = n;
+	index.resize(capacity * 3);
+	animation.resize(capacity);
+	translation.resize(capacity * 2);
+	rotation.resize(capacity * 2);
+	scaling.resize(capacity);
+	model.resize(capacity);
+	dirty.resize(capacity);
+	group.resize(capacity);
+	alive.resize(capacity);
+	generation.resize(capacity);
+	next.resize(capacity);
+	prev.resize(capacity);
+	order.resize(capacity);
+	moved.resize(capacity);
+	redrawn.resize(capacity);
+}
+
+// Add a triangle with identity transforms on top of the draw order. xy holds the three
+// vertices, returns its slot.
+inline int TriangleStore::push_back(const float* xy, float c) {
+	int i = free_head;
+	if (i != -1) { free_head = next[i]; }
+	else {
+		if (slots == capacity) { reserve(std::max(64, capacity * 2)); }
+		i = slots ++;
+		generation[i] = 0;
+	}
+	count ++;
+	int page = i / PAGE_TRIANGLES;
+	if (page >= (int)page_count.size()) { page_count.resize(page + 1, 0); }
+	page_count[page] ++;
+	alive[i] = 1;
+	if (weld_tolerance > 0) { compose_dirty(); } // a triangle transformed since leaves the welding grid
+	for (int k = 0; k < 3; k++) { index[i * 3 + k] = weld(xy[k * 2], xy[k * 2 + 1], c, page); }
+	index_edits.push_back(i);
+	animation[i] = 0.0;
+	translation[i * 2] = 0.0;
+	translation[i * 2 + 1] = 0.0;
+	rotation[i * 2] = 1.0;
+	rotation[i * 2 + 1] = 0.0;
+	scaling[i] = 1.0;
+	model[i] = Affine2::identity();
+	group[i] = 0;
+	dirty[i] = 0;
+	if (next_order == DRAW_ORDER_SPAN) { renumber(); }
+	order[i] = next_order ++;
+	mark_moved(i);
+
+	prev[i] = tail;
+	next[i] = -1;
+	if (tail != -1) { next[tail] = i; } else { head = i; }
+	tail = i;
+	return i;
+}
+
+// Free slot i. O(1): nothing is moved and every other slot and handle stays valid. When it
+// was the last triangle of its page, the vertex slots of the page start over and the page is
+// listed in emptied, for its GPU storage to be released.
+inline void TriangleStore::remove(int i) {
+	if (prev[i] != -1) { next[prev[i]] = next[i]; } else { head = next[i]; }
+	if (next[i] != -1) { prev[next[i]] = prev[i]; } else { tail = prev[i]; }
+	alive[i] = 0;
+	dirty[i] = 0;
+	generation[i] ++;
+	order[i] = 0;
+	mark_redrawn(i);
+	for (int k = 0; k < 3; k++) { release_vertex(index[i * 3 + k]); }
+	next[i] = free_head;
+	free_head = i;
+	count --;
+	int page = i / PAGE_TRIANGLES;
+	if (-- page_count[page] == 0) {
+		vertex_free[page].clear();
+		vertex_used[page] = 0;
+		emptied.push_back(page);
+	}
+}
+
+inline void TriangleStore::clear(void) {
+	for (int i = head; i != -1; ) {
+		int n = next[i];
+		remove(i);
+		i = n;
+	}
+	dirty_list.clear();
+	for (size_t k = 0; k < moved_list.size(); k++) { moved[moved_list[k]] = 0; }
+	moved_list.clear();
+}
+
+inline TriangleHandle TriangleStore::handle(int i) const {
+	TriangleHandle h = {i, generation[i]};
+	return h;
+}
+
+inline bool TriangleStore::valid(TriangleHandle h) const {
+	return h.slot >= 0 && h.slot < slots && alive[h.slot] && generation[h.slot] == h.generation;
+}
+
+inline int TriangleStore::resolve(TriangleHandle h) const {
+	return valid(h) ? h.slot : -1;
+}
+
+inline void TriangleStore::mark_dirty(int i) {
+	if (!dirty[i]) {
+		dirty[i] = 1;
+		dirty_list.push_back(i);
+	}
+}
+
+inline void TriangleStore::mark_moved(int i) {
+	if (!moved[i]) {
+		moved[i] = 1;
+		moved_list.push_back(i);
+	}
+	mark_redrawn(i);
+}
+
+inline void TriangleStore::mark_redrawn(int i) {
+	if (!redrawn[i]) {
+		redrawn[i] = 1;
+		redrawn_list.push_back(i);
+	}
+}
+
+// Number the draw order keys 1, 2, ... again from the bottom, once they reach
+// DRAW_ORDER_SPAN: the renderer turns them into depths, which must stay apart. O(N), once
+// every few million inserts.
+inline void TriangleStore::renumber(void) {
+	next_order = 1;
+	for (int i = head; i != -1; i = next[i]) {
+		order[i] = next_order ++;
+		mark_moved(i);
+	}
+}
+
+// Recompute the model matrix of every dirty triangle:
+//   model = T(translation) * T(barycenter) * R(rotation) * S(scaling) * T(-barycenter)
+// The triangles are gathered COMPOSE_LANES at a time into lane arrays, so the arithmetic
+// runs as straight-line loops over the lanes that the compiler turns into SIMD code.
+inline void TriangleStore::compose_dirty(void) {
+	int n = 0;
+	for (size_t k = 0; k < dirty_list.size(); k++) { // drop entries invalidated by remove
+		int i = dirty_list[k];
+		if (dirty[i]) {
+			dirty[i] = 0;
+			dirty_list[n ++] = i;
+		}
+	}
+	for (int base = 0; base < n; base += COMPOSE_LANES) {
+		int lanes = std::min(COMPOSE_LANES, n - base);
+		int slot[COMPOSE_LANES];
+		float tx[COMPOSE_LANES], ty[COMPOSE_LANES], rc[COMPOSE_LANES], rs[COMPOSE_LANES], k[COMPOSE_LANES];
+		float bx[COMPOSE_LANES], by[COMPOSE_LANES];
+		float m[6][COMPOSE_LANES];
+
+		for (int l = 0; l < COMPOSE_LANES; l++) { // gather, the tail repeats the last triangle
+			int i = slot[l] = dirty_list[base + std::min(l, lanes - 1)];
+			const float* p0 = &position[index[i * 3] * 2];
+			const float* p1 = &position[index[i * 3 + 1] * 2];
+			const float* p2 = &position[index[i * 3 + 2] * 2];
+			tx[l] = translation[i * 2];
+			ty[l] = translation[i * 2 + 1];
+			rc[l] = rotation[i * 2];
+			rs[l] = rotation[i * 2 + 1];
+			k[l] = scaling[i];
+			bx[l] = (p0[0] + p1[0] + p2[0]) / 3.0f;
+			by[l] = (p0[1] + p1[1] + p2[1]) / 3.0f;
+		}
+		for (int l = 0; l < COMPOSE_LANES; l++) {
+			m[0][l] = k[l] * rc[l];
+			m[1][l] = k[l] * rs[l];
+			m[2][l] = -k[l] * rs[l];
+			m[3][l] = k[l] * rc[l];
+			m[4][l] = tx[l] + bx[l] - (m[0][l] * bx[l] + m[2][l] * by[l]);
+			m[5][l] = ty[l] + by[l] - (m[1][l] * bx[l] + m[3][l] * by[l]);
+		}
+		for (int l = 0; l < lanes; l++) { // scatter
+			Affine2& out = model[slot[l]];
+			out.a = m[0][l]; out.b = m[1][l]; out.c = m[2][l];
+			out.d = m[3][l]; out.x = m[4][l]; out.y = m[5][l];
+			mark_moved(slot[l]);
+			if (!at_rest(slot[l])) { detach(slot[l]); }
+		}
+	}
+	dirty_list.clear();
+}
+
+// Replace the transform of triangle i by m, which must be a similarity.
+inline void TriangleStore::set_model(int i, const Affine2& m) {
+	m.decompose(barycenter(i), &translation[i * 2], &rotation[i * 2], &scaling[i]);
+	model[i] = m;
+	mark_moved(i);
+	if (!at_rest(i)) { detach(i); }
+}
+
+// Whether triangle i is drawn where its vertices are: identity model, not grouped.
+inline bool TriangleStore::at_rest(int i) const {
+	const Affine2& m = model[i];
+	return group[i] == 0 && m.a == 1 && m.b == 0 && m.c == 0 && m.d == 1 && m.x == 0 && m.y == 0;
+}
+
+// Triangle i no longer shares vertices: each welded corner gets a copy of its vertex, or
+// leaves the welding grid if no other corner uses it, so later inserts do not weld to it.
+inline void TriangleStore::detach(int i) {
+	bool changed = false;
+	for (int k = 0; k < 3; k++) {
+		int v = index[i * 3 + k];
+		if (!welded[v]) { continue; }
+		if (refs[v] == 1) {
+			unweld(v);
+			continue;
+		}
+		refs[v] --;
+		index[i * 3 + k] = new_vertex(position[v * 2], position[v * 2 + 1], color[v], i / PAGE_TRIANGLES);
+		changed = true;
+	}
+	if (changed) { index_edits.push_back(i); }
+}
+
+// Put triangle i in group g (the group tree keeps the member lists).
+inline void TriangleStore::set_group(int i, int g) {
+	group[i] = g;
+	if (g != 0) { detach(i); }
+}
+
+inline Eigen::Vector2f TriangleStore::vertex(int i, int k) const {
+	int v = index[i * 3 + k];
+	return Eigen::Vector2f(position[v * 2], position[v * 2 + 1]);
+}
+
+inline Eigen::Vector2f TriangleStore::barycenter(int i) const {
+	return (vertex(i, 0) + vertex(i, 1) + vertex(i, 2)) / 3.0;
+}
+
+inline float TriangleStore::corner_color(int i, int k) const {
+	return color[index[i * 3 + k]];
+}
+
+// Recolor corner k of triangle i, and every corner welded to it.
+inline void TriangleStore::set_corner_color(int i, int k, float c) {
+	int v = index[i * 3 + k];
+	color[v] = c;
+	vertex_edits.push_back(v);
+}
+
+inline void TriangleStore::reserve_vertices(int n) {
+	if (n <= vertex_capacity) { return; }
+	vertex_capacity = n;
+	position.resize(vertex_capacity * 2);
+	color.resize(vertex_capacity);
+	refs.resize(vertex_capacity);
+	welded.resize(vertex_capacity);
+}
+
+// Key of the welding cell (dx,dy) cells away from the one holding x,y.
+inline long long TriangleStore::weld_key(float x, float y, int dx, int dy) const {
+	long long ix = (long long)floor(x / WELD_CELL) + dx;
+	long long iy = (long long)floor(y / WELD_CELL) + dy;
+	return (ix << 32) ^ (iy & 0xffffffffLL);
+}
+
+// Return a vertex of the page within weld_tolerance of x,y, or a new vertex there with color c.
+inline int TriangleStore::weld(float x, float y, float c, int page) {
+	if (weld_tolerance > 0) {
+		float tolerance = std::min(weld_tolerance, WELD_CELL);
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				auto range = weld_grid.equal_range(weld_key(x, y, dx, dy));
+				for (auto it = range.first; it != range.second; ++it) {
+					int v = it->second;
+					if (v / PAGE_VERTICES != page) { continue; }
+					if (fabs(position[v * 2] - x) <= tolerance && fabs(position[v * 2 + 1] - y) <= tolerance) {
+						refs[v] ++;
+						return v;
+					}
+				}
+			}
+		}
+	}
+	int v = new_vertex(x, y, c, page);
+	weld_grid.insert(std::make_pair(weld_key(x, y, 0, 0), v));
+	welded[v] = 1;
+	return v;
+}
+
+// A vertex of the page at x,y with color c, used by one corner and out of the welding grid.
+inline int TriangleStore::new_vertex(float x, float y, float c, int page) {
+	if (page >= (int)vertex_used.size()) {
+		vertex_used.resize(page + 1, 0);
+		vertex_free.resize(page + 1);
+	}
+	int v;
+	if (!vertex_free[page].empty()) {
+		v = vertex_free[page].back();
+		vertex_free[page].pop_back();
+	} else {
+		v = page * PAGE_VERTICES + vertex_used[page] ++;
+		if (v >= vertex_capacity) { reserve_vertices(std::max(std::max(192, v + 1), vertex_capacity * 2)); }
+		vertex_slots = std::max(vertex_slots, v + 1);
+	}
+	vertex_count ++;
+	position[v * 2] = x;
+	position[v * 2 + 1] = y;
+	color[v] = c;
+	refs[v] = 1;
+	welded[v] = 0;
+	vertex_edits.push_back(v);
+	return v;
+}
+
+inline void TriangleStore::release_vertex(int v) {
+	if (-- refs[v] > 0) { return; }
+	unweld(v);
+	vertex_free[v / PAGE_VERTICES].push_back(v);
+	vertex_count --;
+}
+
+// Move vertex v, and every corner sharing it, to x,y.
+inline void TriangleStore::move_vertex(int v, float x, float y) {
+	bool was_welded = welded[v];
+	unweld(v);
+	position[v * 2] = x;
+	position[v * 2 + 1] = y;
+	vertex_edits.push_back(v);
+	if (was_welded) {
+		weld_grid.insert(std::make_pair(weld_key(x, y, 0, 0), v));
+		welded[v] = 1;
+	}
+}
+
+// Take vertex v out of the welding grid.
+inline void TriangleStore::unweld(int v) {
+	if (!welded[v]) { return; }
+	welded[v] = 0;
+	auto range = weld_grid.equal_range(weld_key(position[v * 2], position[v * 2 + 1], 0, 0));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == v) {
+			weld_grid.erase(it);
+			return;
+		}
+	}
+}
+
 class Editor {
 	public:
 		int mode;
-		int triangle_count;    // Numbers of triangle that have been inserted.
 		int insert_step;       // Indicate which step (1,2,3) is the program at of insertion. 
 		int ith_triangle;      // Used by: Translate, Delete, Animation. Which triangle was clicked.
+		int ith_group;         // Outermost group of the clicked triangle, 0 if it is not grouped.
+		int hover_triangle;    // Triangle under the cursor, highlighted when nothing is clicked. -1 if none.
 		bool triangle_clicked; // If the mouse now clicked on a triangle.
 		int closest_vertex;    // Used by: Colorize, Bezier
 		int bezier_step;       // Which step is the program at when editing bezier curve.
+		int select_step;       // 0, or 1 while a rubber band is dragged, 2 while a lasso is drawn.
 		float aspect_ratio;
 		float width;
 		float height;
 		int animation_type;    // animation type: 1-7.
 		int snap_num;          // screen shot counter. for different file names.
 
-		Eigen::MatrixXf V;
+		TriangleStore triangles; // All inserted triangles.
+		GroupTree groups;        // Nested groups the triangles belong to.
+		ShapeLibrary shapes;     // Shapes stamped from the scene and their instances.
+		TrianglePicker picker;   // Bounds tree and edge functions for click_on_triangle, refreshed by sync.
+		PointGrid corners;       // World position of corner k of triangle t as id t*3+k, refreshed by sync_corners.
+		std::vector<char> corners_dirty; // The triangle was refreshed by sync since its corners were.
+		std::vector<int> corners_dirty_list;
+		IdBuffer id_buffer;      // Triangle under each pixel, for hover_at.
+		Selection selection;     // Triangles picked by rubber band or lasso, edited together.
+		Eigen::Vector2f selection_drag; // World offset the selection is dragged by and drawn at, not applied yet.
+		int stamp_shape;         // Shape stamped by the B key, -1 until one is made.
+		TriangleHandle stamp_source; // Clicked triangle the stamp shape was made from.
+		int stamp_group;             // and its outermost group.
+		TriangleHandle clicked_history[2]; // The two most recently clicked triangles, for grouping.
+		Timeline timeline;       // Keyframe tracks of triangles and groups, played by pose.
+		bool posing;             // pose applied the timeline: the posed_* arrays hold.
+		std::vector<Affine2> posed_group; // World transform of each group at the posed time.
+		std::vector<char> group_keyed;    // The group, or one above it, has tracks.
+		std::vector<float> group_tint;    // r,g,b,a of each group, a = 1 if a color track sets it.
+		std::vector<Affine2> posed_model; // Model of each triangle slot with tracks.
+		std::vector<char> posed_keyed;    // The triangle slot has tracks.
+		std::vector<float> posed_tint;    // r,g,b,a of each triangle slot, as group_tint.
+		std::vector<int> posed_list;      // Slots set in the posed_* arrays.
+		std::vector<int> keyed_list;      // Slots keyed holds for, own tracks or a keyed group.
+		unsigned pose_serial;             // Bumped by pose.
+		unsigned picked_pose;             // Pose the picker holds the keyed slots at.
+		AnimationTable shown;    // The built-in animations at the time on screen, set by show.
+		Eigen::MatrixXf preview; // Vertices of the triangle, bezier curve or selection outline being edited (x,y per column).
 		Eigen::Matrix4f view;
-		Eigen::MatrixXf model;
-		Eigen::MatrixXf translation;
-		Eigen::MatrixXf rotation;
-		Eigen::MatrixXf scaling;
 
 		Vector2d p0; // previous cursor position
 		Vector2d p1; // current cursor position
 
 	void init(void);
+	void compose(void);
+	void sync(void);
+	void sync_shown(void);
+	void sync_corners(void);
+	void show(float time);
+	void touch_all(void);
 	bool click_on_triangle(Eigen::Vector2d world_coord_2d);
-	void find_closest_vertex(int from, int to, int nv);
-	void model_matrix_expand(void);
+	int hover_at(Eigen::Vector4f pixel, int width, int height);
+	void find_closest_vertex(void);
+	void find_closest_control_point(void);
+	void insert_triangle(void);
 	void rotate_by(double degree, int direction);
 	void scale_by(double percentage, int up);
 	void delete_at(int triangle_index);
+	void begin_selection(bool lasso);
+	void extend_selection(void);
+	void end_selection(void);
+	Eigen::Vector2f centroid(int t) const;
+	Eigen::Vector2f selection_center(void) const;
+	void translate_selection(float dx, float dy);
+	void apply_selection_drag(void);
+	void transform_selection(const Affine2& delta);
+	void colorize_selection(float c);
+	void animate_selection(int type);
+	void mark_group_moved(int g);
+	void group_clicked(void);
+	void ungroup_clicked(void);
+	Affine2 world_transform(int t);
+	void stamp_clicked(void);
+	void key_clicked(void);
+	void toggle_interpolation_clicked(void);
+	void pose(float time);
+	void unpose(void);
+	bool keyed(int t) const;
+	Affine2 posed_world(int t);
+	Affine2 shown_world(int t);
+	void set_animation(int t, int type);
+	const float* tint(int t) const;
+	bool import_off(const std::string& filename);
 	void switch_mode(int m);
 	float bezier_curve(float V1, float V2, float V3, float V4, float t);
-	void screenshot(const char* filename);
+	void screenshot(const char* filename, bool animated = false);
+	std::string svg_triangle(const Vector2f* v, const float* c, int id, const float* rgb = NULL);
+	std::vector<std::string> svg_motions(float unit);
+	std::string svg_motion(const std::vector<std::string>& motions, int type, float phase, const Vector2f& pivot, std::string& close);
 	Eigen::Vector2d pixel_to_world_coord(Eigen::Vector4f pixel, int width, int height);
 	std::string color_to_hex(float c);
+	std::string rgb_to_hex(const float* rgb);
+	void color_to_rgb(float c, float* rgb);
 };
 
 inline void Editor::switch_mode(int m){
 	triangle_clicked = false;
 	ith_triangle = -1;
+	hover_triangle = -1;
+	ith_group = 0;
 	insert_step = 0;
 	closest_vertex = -1;
 	bezier_step = 0;
+	select_step = 0;
+	if ((mode == ANIMATION_MODE) != (m == ANIMATION_MODE)) { // the animated triangles start or stop moving
+		for (int t = triangles.head; t != -1; t = triangles.next[t]) {
+			if (triangles.animation[t] != 0) { triangles.mark_moved(t); }
+		}
+	}
 	mode = m;
-	V.conservativeResize(4, triangle_count * 3);
+	preview.resize(2, 0);
 
 	if (m == INSERT_MODE) { std::cout << "Insertion mode is on." << std::endl; }
 	else if (m == TRANSLATION_MODE) { std::cout << "Translation mode is on." << std::endl; }
@@ -87,57 +669,172 @@ inline void Editor::switch_mode(int m){
 inline void Editor::init(void) {
 	mode = 0;
 	insert_step = 0;
-	triangle_count = 1;
 	triangle_clicked = false;
 	ith_triangle = -1;
+	hover_triangle = -1;
+	ith_group = 0;
 	closest_vertex = -1;
 	animation_type = 1;
 	bezier_step = 0;
+	select_step = 0;
 
 	view = MatrixXf::Identity(4, 4);
-	model = MatrixXf::Identity(4, 4);
-	translation = MatrixXf::Identity(4, 4);
-	rotation = MatrixXf::Identity(4, 4);
-	scaling = MatrixXf::Identity(4, 4);
 
 	p0 = Vector2d(0,0);
 	p1 = Vector2d(0,0);
-	V.resize(4,3);
-	V << 0.0, 0.3, -0.3, 0.3, -0.3, -0.3, -1.0, -1.0, -1.0, 0.0, 0.0, 0.0;
+	preview.resize(2, 0);
+	triangles.init();
+	groups.init();
+	picker.init();
+	corners.init();
+	corners_dirty.clear();
+	corners_dirty_list.clear();
+	id_buffer.init();
+	selection.init();
+	selection_drag.setZero();
+	float xy[6] = {0.0, 0.3, 0.3, -0.3, -0.3, -0.3};
+	groups.add_member(0, triangles.push_back(xy, -1.0));
+	triangles.weld_tolerance = WELD_CELL; // inserted corners snap to the vertices nearby
+	TriangleHandle none = {-1, 0};
+	clicked_history[0] = clicked_history[1] = none;
+	shapes.init();
+	stamp_shape = -1;
+	stamp_source = none;
+	stamp_group = 0;
+	timeline.init();
+	posing = false;
+	keyed_list.clear();
+	pose_serial = picked_pose = 0;
+	shown.evaluate(0.0f, false);
 }
 
-inline bool Editor::click_on_triangle(Eigen::Vector2d world_coord_2d) {
-	for (int i = 0; i < V.cols(); i = i+3) {
-		int j = V.cols() - i - 3;
-
-		Eigen::Vector4f v1(V(0,j), V(1,j), 0, 1);
-		Eigen::Vector4f v2(V(0,j+1), V(1,j+1), 0, 1);
-		Eigen::Vector4f v3(V(0,j+2), V(1,j+2), 0, 1);
-		// world coordinates
-		v1 = model.block(0, floor(j/3) * 4, 4, 4) * v1;
-		v2 = model.block(0, floor(j/3) * 4, 4, 4) * v2;
-		v3 = model.block(0, floor(j/3) * 4, 4, 4) * v3;
-
-		MatrixXf m(3,2);
-		m << (RowVector2f)(v1.head(2)), (RowVector2f)(v2.head(2)), (RowVector2f)(v3.head(2));
-		m.transposeInPlace();
-
-		Matrix3f A;
-		Vector3f b;
-		A << m, 1, 1, 1;
-		b << world_coord_2d(0), world_coord_2d(1), 1;
-		Vector3f x = A.colPivHouseholderQr().solve(b);
-
-		if (x(0) > 0 && x(1) > 0 && x(2) > 0) {
-			ith_triangle = floor(j/3);
-			triangle_clicked = true;
-			return true;
-		} else {
-			ith_triangle = -1;
-			triangle_clicked = false;
+// Recompose the model matrices and the group world transforms changed since the last call:
+// what the renderer needs. A group that moved stays in groups.moved_list, its triangles are
+// only refreshed in the caches by sync, so dragging a group is O(1) until something is picked.
+// So is dragging the selection: the offset waits in selection_drag.
+inline void Editor::compose(void) {
+	triangles.compose_dirty();
+	groups.update();
+}
+
+// Bring the picker up to date with the edits made since the last call, the drag of the
+// selection applied. Only the triangles that moved are refreshed, so it is cheap to call
+// before every query, and they are queued for sync_corners. They are cached as drawn: posed
+// by the timeline, and with their built-in animation in the animation mode.
+inline void Editor::sync(void) {
+	apply_selection_drag();
+	compose();
+	for (size_t k = 0; k < groups.moved_list.size(); k++) {
+		int g = groups.moved_list[k];
+		if (!groups.moved[g]) { continue; } // removed since
+		groups.moved[g] = 0;
+		mark_group_moved(g);
+	}
+	groups.moved_list.clear();
+
+	picker.reserve(triangles.capacity);
+	for (size_t k = 0; k < triangles.moved_list.size(); k++) {
+		int t = triangles.moved_list[k];
+		triangles.moved[t] = 0;
+		if (!triangles.alive[t]) { continue; }
+		Vector2f v[3] = {triangles.vertex(t, 0), triangles.vertex(t, 1), triangles.vertex(t, 2)};
+		bool is_posed = keyed(t);
+		Affine2 world = is_posed ? posed_world(t) : groups.world[triangles.group[t]] * triangles.model[t];
+		int type = (mode == ANIMATION_MODE) ? (int)triangles.animation[t] : 0;
+		picker.refresh(t, world, v, triangles.order[t], type, is_posed);
+		if (t >= (int)corners_dirty.size()) { corners_dirty.resize(triangles.capacity, 0); }
+		if (!corners_dirty[t]) {
+			corners_dirty[t] = 1;
+			corners_dirty_list.push_back(t);
 		}
 	}
-	return false;
+	triangles.moved_list.clear();
+	picker.update();
+}
+
+// Bring the corner grid up to the triangles sync refreshed, after it. Only the vertex and
+// region queries read the grid, so a large move pays for it at the first of them rather
+// than on the frame it ends. The animated corners leave the grid, as they are nowhere for long.
+inline void Editor::sync_corners(void) {
+	for (size_t k = 0; k < corners_dirty_list.size(); k++) {
+		int t = corners_dirty_list[k];
+		corners_dirty[t] = 0;
+		if (!triangles.alive[t]) { continue; }
+		bool is_posed = keyed(t);
+		Affine2 world = is_posed ? posed_world(t) : groups.world[triangles.group[t]] * triangles.model[t];
+		int type = (mode == ANIMATION_MODE) ? (int)triangles.animation[t] : 0;
+		for (int j = 0; j < 3; j++) {
+			Vector2f w = world * triangles.vertex(t, j);
+			if (type != 0) { corners.remove(t * 3 + j); }
+			else { corners.move(t * 3 + j, w(0), w(1)); }
+		}
+	}
+	corners_dirty_list.clear();
+}
+
+// sync, with the keyed triangles at the pose on screen. They are brought to it only when
+// something is picked, so a playing timeline costs the picker nothing in between.
+inline void Editor::sync_shown(void) {
+	if (posing && picked_pose != pose_serial) {
+		for (size_t k = 0; k < keyed_list.size(); k++) { triangles.mark_moved(keyed_list[k]); }
+		picked_pose = pose_serial;
+	}
+	sync();
+}
+
+// The frame on screen is drawn at time, the picking follows its built-in animations.
+inline void Editor::show(float time) {
+	shown.evaluate(time, mode == ANIMATION_MODE);
+}
+
+// Every triangle of group g and of its subgroups has moved.
+inline void Editor::mark_group_moved(int g) {
+	for (int t = groups.first_member[g]; t != -1; t = groups.member_next[t]) { triangles.mark_moved(t); }
+	for (size_t k = 0; k < groups.children[g].size(); k++) { mark_group_moved(groups.children[g][k]); }
+}
+
+// Recompose every triangle, after an edit of shared vertices that may have moved any of them.
+inline void Editor::touch_all(void) {
+	for (int t = triangles.head; t != -1; t = triangles.next[t]) { triangles.mark_dirty(t); }
+}
+
+// The topmost triangle under the cursor, as the picker finds it, where it is drawn.
+inline bool Editor::click_on_triangle(Eigen::Vector2d world_coord_2d) {
+	sync_shown();
+	int j = picker.pick(world_coord_2d(0), world_coord_2d(1), shown);
+	if (j == -1) {
+		ith_triangle = -1;
+		ith_group = 0;
+		triangle_clicked = false;
+		return false;
+	}
+	ith_triangle = j;
+	ith_group = groups.top(triangles.group[j]);
+	triangle_clicked = true;
+	if (clicked_history[0].slot != j) {
+		clicked_history[1] = clicked_history[0];
+		clicked_history[0] = triangles.handle(j);
+	}
+	return true;
+}
+
+// The topmost triangle under a pixel of the window, read from the ID buffer. The buffer is
+// rasterized again only when the still scene, the view or the window size changed since;
+// the moving triangles over the pixel come from the picker, at the time on screen.
+inline int Editor::hover_at(Eigen::Vector4f pixel, int width, int height) {
+	sync_shown();
+	int t = id_buffer.lookup(picker, view, (int)pixel(0), (int)pixel(1), width, height);
+	if (picker.moving_count == 0) { return t; }
+	Eigen::Vector2d p = pixel_to_world_coord(pixel, width, height);
+	int m = picker.pick(p(0), p(1), shown, true);
+	return (m != -1 && (t == -1 || picker.order[m] > picker.order[t])) ? m : t;
+}
+
+// World transform of triangle t: the transforms of its groups applied after its own.
+inline Affine2 Editor::world_transform(int t) {
+	triangles.compose_dirty();
+	groups.update();
+	return groups.world[triangles.group[t]] * triangles.model[t];
 }
 
 inline Eigen::Vector2d Editor::pixel_to_world_coord(Eigen::Vector4f pixel, int width, int height) {
@@ -147,84 +844,549 @@ inline Eigen::Vector2d Editor::pixel_to_world_coord(Eigen::Vector4f pixel, int w
 	return world_coord_2d;
 }
 
+// Multiply the rotation stored as cos,sin in r by the angle theta.
+inline void rotate_cos_sin(float* r, double theta) {
+	float c = r[0] * cos(theta) - r[1] * sin(theta);
+	float s = r[1] * cos(theta) + r[0] * sin(theta);
+	float norm = sqrt(c * c + s * s);
+	r[0] = c / norm;
+	r[1] = s / norm;
+}
+
+// A grouped triangle rotates and scales with its whole outermost group, about the group pivot.
 inline void Editor::rotate_by(double degree, int direction) {
-	if (mode == TRANSLATION_MODE && ith_triangle != -1) {
+	if (mode == TRANSLATION_MODE && !selection.empty()) { // the whole selection, about its center
+		sync();
+		sync_corners();
+		double theta = (direction == 0 ? -1 : 1) * degree * (M_PI / 180);
+		transform_selection(Affine2::about(selection_center(), Affine2::rotate(theta)));
+	}
+	else if (mode == TRANSLATION_MODE && ith_triangle != -1) {
 		double theta;
 		if (direction == 0) {theta = (-1) * degree * (M_PI / 180);} //std::cout << "Rotate the primitive clockwise by 10 degree." << std::endl;
 		else {theta = degree * (M_PI / 180);} //std::cout << "Rotate the primitive counter-clockwise by 10 degree." << std::endl;
 
-		int i = ith_triangle * 3;
-		Eigen::Vector4f v1(V(0,i), V(1,i), 0, 1);
-		Eigen::Vector4f v2(V(0,i+1), V(1,i+1), 0, 1);
-		Eigen::Vector4f v3(V(0,i+2), V(1,i+2), 0, 1);
-		Vector2f barycenter ((v1(0) + v2(0) + v3(0))/3, (v1(1) + v2(1) + v3(1))/3);
+		// Rotations are all about the barycenter, so they accumulate as one angle.
+		if (ith_group != 0) {
+			rotate_cos_sin(&groups.rotation[ith_group * 2], theta);
+			groups.mark_dirty(ith_group);
+		} else {
+			rotate_cos_sin(&triangles.rotation[ith_triangle * 2], theta);
+			triangles.mark_dirty(ith_triangle);
+		}
+	}
+}
 
-		Eigen::Matrix4f m0 = MatrixXf::Identity(4, 4);
-		Eigen::Matrix4f m1 = MatrixXf::Identity(4, 4);
-		m0(0, 3) = -barycenter(0);
-		m0(1, 3) = -barycenter(1);
-		m1(0, 3) = barycenter(0);
-		m1(1, 3) = barycenter(1);
+inline void Editor::scale_by(double percentage, int up) {
+	if (mode == TRANSLATION_MODE && !selection.empty()) {
+		sync();
+		sync_corners();
+		transform_selection(Affine2::about(selection_center(), Affine2::scale(up ? 1 - percentage : 1 + percentage)));
+	}
+	else if (mode == TRANSLATION_MODE && ith_triangle != -1) {
+		float* k = (ith_group != 0) ? &groups.scaling[ith_group] : &triangles.scaling[ith_triangle];
+		if (up) {*k *= (1 - percentage);} //std::cout << "Scale the primitive up by 25%." << std::endl;
+		else {*k *= (1 + percentage);} //std::cout << "Scale the primitive down by 25%." << std::endl;
+		if (ith_group != 0) { groups.mark_dirty(ith_group); }
+		else { triangles.mark_dirty(ith_triangle); }
+	}
+}
+
+inline void Editor::delete_at(int triangle_index) {
+	std::vector<int> freed;
+	groups.remove_member(triangles.group[triangle_index], triangle_index, &freed);
+	for (size_t k = 0; k < freed.size(); k++) { timeline.remove_target(freed[k], true); } // the id is reused
+	triangles.remove(triangle_index);
+	picker.clear(triangle_index);
+	for (int k = 0; k < 3; k++) { corners.remove(triangle_index * 3 + k); }
+	if (hover_triangle == triangle_index) { hover_triangle = -1; }
+	selection.remove(triangle_index);
+	timeline.remove_target(triangle_index, false);
+}
+
+// Start a rubber band (or a lasso) at the cursor. The outline is kept in preview.
+inline void Editor::begin_selection(bool lasso) {
+	select_step = lasso ? 2 : 1;
+	preview.resize(2, lasso ? 1 : 4);
+	for (int k = 0; k < preview.cols(); k++) { preview.col(k) << p1(0), p1(1); }
+}
 
-		Matrix4f r = MatrixXf::Identity(4, 4);
-		r.topLeftCorner(2,2) << cos(theta), -sin(theta), sin(theta), cos(theta);
+// Follow the cursor: move the far corner of the band, or add a point to the lasso.
+inline void Editor::extend_selection(void) {
+	if (select_step == 1) {
+		preview(0, 1) = preview(0, 2) = p1(0);
+		preview(1, 2) = preview(1, 3) = p1(1);
+	}
+	else if (select_step == 2) {
+		Vector2f last = preview.col(preview.cols() - 1);
+		if ((last - p1.cast<float>()).norm() < 0.005) { return; } // keep the lasso short
+		preview.conservativeResize(2, preview.cols() + 1);
+		preview.col(preview.cols() - 1) << p1(0), p1(1);
+	}
+}
 
-		rotation.block(0, ith_triangle * 4, 4, 4) = m1 * r * m0 * rotation.block(0, ith_triangle * 4, 4, 4);
+// Select the triangles whose centroid lies in the band or lasso, in place of the old selection.
+// The bounds tree gives the triangles around the outline; only those are tested.
+inline void Editor::end_selection(void) {
+	if (select_step == 0) { return; }
+	sync();
+	sync_corners();
+	selection.clear();
+	Vector2f lo = preview.rowwise().minCoeff();
+	Vector2f hi = preview.rowwise().maxCoeff();
+	float region[4] = {lo(0), lo(1), hi(0), hi(1)};
+	std::vector<int> candidates;
+	picker.tree.query(region, candidates);
+	int n = (int)preview.cols();
+	for (size_t k = 0; k < candidates.size(); k++) {
+		Vector2f c = centroid(candidates[k]);
+		if (c(0) < lo(0) || c(1) < lo(1) || c(0) > hi(0) || c(1) > hi(1)) { continue; }
+		bool inside = true;
+		if (select_step == 2) { // even-odd rule
+			inside = false;
+			for (int i = 0, j = n - 1; i < n; j = i++) {
+				float yi = preview(1, i), yj = preview(1, j);
+				if ((yi > c(1)) != (yj > c(1)) &&
+					c(0) < preview(0, j) + (c(1) - yj) / (yi - yj) * (preview(0, i) - preview(0, j))) { inside = !inside; }
+			}
+		}
+		if (inside) { selection.add(candidates[k]); }
 	}
+	select_step = 0;
+	preview.resize(2, 0);
+	std::cout << "Selected " << selection.size() << " triangles." << std::endl;
 }
 
-inline void Editor::scale_by(double percentage, int up) {
-	if (mode == TRANSLATION_MODE && ith_triangle != -1) {
-		Matrix4f s = MatrixXf::Identity(4, 4);
-		if (up) {s.topLeftCorner(2,2) << (1 - percentage), 0, 0, (1 - percentage);} //std::cout << "Scale the primitive up by 25%." << std::endl;
-		else {s.topLeftCorner(2,2) << (1 + percentage), 0, 0, (1 + percentage);} //std::cout << "Scale the primitive down by 25%." << std::endl;
+// World centroid of triangle t, from the corner grid (see sync_corners).
+inline Eigen::Vector2f Editor::centroid(int t) const {
+	const float* p = &corners.position[t * 6];
+	return Vector2f((p[0] + p[2] + p[4]) / 3, (p[1] + p[3] + p[5]) / 3);
+}
 
-		int i = ith_triangle * 3;
-		Eigen::Vector4f v1(V(0,i), V(1,i), 0, 1);
-		Eigen::Vector4f v2(V(0,i+1), V(1,i+1), 0, 1);
-		Eigen::Vector4f v3(V(0,i+2), V(1,i+2), 0, 1);
-		Vector2f barycenter ((v1(0) + v2(0) + v3(0))/3, (v1(1) + v2(1) + v3(1))/3);
+inline Eigen::Vector2f Editor::selection_center(void) const {
+	Vector2f sum(0, 0);
+	for (size_t k = 0; k < selection.items.size(); k++) { sum += centroid(selection.items[k]); }
+	return sum / std::max(1, selection.size());
+}
 
-		Eigen::Matrix4f m0 = MatrixXf::Identity(4, 4);
-		Eigen::Matrix4f m1 = MatrixXf::Identity(4, 4);
-		m0(0, 3) = -barycenter(0);
-		m0(1, 3) = -barycenter(1);
-		m1(0, 3) = barycenter(0);
-		m1(1, 3) = barycenter(1);
+// Drag the selection by dx,dy in world space. The offset only adds up in selection_drag,
+// which the renderer draws the selection shifted by, so a drag frame is O(1) whatever the
+// size of the selection; sync applies it to the triangles, when something is picked or the
+// drag ends. Its triangles are redrawn when it starts, to follow the offset.
+inline void Editor::translate_selection(float dx, float dy) {
+	if (selection_drag == Vector2f(0, 0)) {
+		for (size_t k = 0; k < selection.items.size(); k++) { triangles.mark_redrawn(selection.items[k]); }
+	}
+	selection_drag += Vector2f(dx, dy);
+}
 
-		scaling.block(0, ith_triangle * 4, 4, 4) = m1 * s * m0 * scaling.block(0, ith_triangle * 4, 4, 4);
+// Move every selected triangle by selection_drag, and clear it. The offset is brought into
+// the frame of the group of each triangle and added to both its translation and its model
+// matrix, as a translation comes last in the model, so nothing has to be recomposed.
+inline void Editor::apply_selection_drag(void) {
+	if (selection_drag == Vector2f(0, 0)) { return; }
+	float dx = selection_drag(0), dy = selection_drag(1);
+	selection_drag.setZero();
+	groups.update();
+	const std::vector<int>& items = selection.items;
+	for (size_t k = 0; k < items.size(); k++) {
+		int t = items[k];
+		const Affine2& w = groups.world[triangles.group[t]];
+		float det = w.a * w.d - w.b * w.c;
+		float inv = (det != 0) ? 1.0f / det : 0.0f;
+		float lx = (w.d * dx - w.c * dy) * inv;
+		float ly = (w.a * dy - w.b * dx) * inv;
+		triangles.translation[t * 2] += lx;
+		triangles.translation[t * 2 + 1] += ly;
+		triangles.model[t].x += lx;
+		triangles.model[t].y += ly;
+		triangles.mark_moved(t);
 	}
 }
 
-inline void Editor::delete_at(int triangle_index) {
-	int i = triangle_index * 3;
-	for(int j = 0; j < 3; j ++) {
-		V.col(i + j) = V.col(triangle_count * 3 - 3 + j);
+// Apply the world space transform delta after the current transform of every selected triangle.
+inline void Editor::transform_selection(const Affine2& delta) {
+	triangles.compose_dirty();
+	groups.update();
+	const std::vector<int>& items = selection.items;
+	for (size_t k = 0; k < items.size(); k++) {
+		int t = items[k];
+		const Affine2& w = groups.world[triangles.group[t]];
+		triangles.set_model(t, w.inverse() * delta * w * triangles.model[t]);
+	}
+}
+
+// Give every corner of the selection the color code c, and so every vertex welded to them.
+inline void Editor::colorize_selection(float c) {
+	const std::vector<int>& items = selection.items;
+	for (size_t k = 0; k < items.size(); k++) {
+		for (int j = 0; j < 3; j++) { triangles.set_corner_color(items[k], j, c); }
+	}
+}
+
+inline void Editor::animate_selection(int type) {
+	const std::vector<int>& items = selection.items;
+	for (size_t k = 0; k < items.size(); k++) { set_animation(items[k], type); }
+}
+
+// The picker caches the animated triangles with their animation.
+inline void Editor::set_animation(int t, int type) {
+	triangles.animation[t] = type;
+	triangles.mark_moved(t);
+}
+
+// Put the outermost groups (or lone triangles) of the two last clicked triangles in a new group.
+inline void Editor::group_clicked(void) {
+	int a = triangles.resolve(clicked_history[0]);
+	int b = triangles.resolve(clicked_history[1]);
+	if (a == -1 || b == -1) { return; }
+	int ga = groups.top(triangles.group[a]);
+	int gb = groups.top(triangles.group[b]);
+	if (ga != 0 && ga == gb) { return; }
+
+	// The new group pivots on the mean barycenter of everything it holds.
+	Vector2f pivot(0, 0);
+	int n = 0;
+	for (int t = triangles.head; t != -1; t = triangles.next[t]) {
+		int gt = groups.top(triangles.group[t]);
+		if ((ga != 0 ? gt == ga : t == a) || (gb != 0 ? gt == gb : t == b)) {
+			pivot += world_transform(t) * triangles.barycenter(t);
+			n ++;
+		}
+	}
+	int g = groups.create(0, pivot / n);
+	int items[2][2] = {{ga, a}, {gb, b}};
+	for (int k = 0; k < 2; k++) { // the new group is the identity, so nothing moves
+		if (items[k][0] != 0) { groups.reparent(items[k][0], g); }
+		else {
+			groups.move_member(items[k][1], 0, g);
+			triangles.set_group(items[k][1], g);
+		}
+	}
+	ith_group = g;
+	std::cout << "Grouped into group " << g << "." << std::endl;
+}
+
+// Stamp an instance of the clicked triangle, or of its outermost group, at the cursor.
+// The shape is made on the first stamp and its geometry is shared by all later stamps.
+inline void Editor::stamp_clicked(void) {
+	if (ith_triangle == -1) { return; }
+	if (stamp_shape == -1 || triangles.resolve(stamp_source) == -1 ||
+		(stamp_group == 0 ? stamp_source.slot != ith_triangle : stamp_group != ith_group)) {
+		std::vector<float> xy, c;
+		Vector2f center(0, 0);
+		for (int t = triangles.head; t != -1; t = triangles.next[t]) {
+			if (ith_group != 0 ? groups.top(triangles.group[t]) != ith_group : t != ith_triangle) { continue; }
+			Affine2 m = world_transform(t);
+			for (int k = 0; k < 3; k++) {
+				Vector2f v = m * triangles.vertex(t, k);
+				xy.push_back(v(0));
+				xy.push_back(v(1));
+				c.push_back(triangles.corner_color(t, k));
+				center += v / 3.0;
+			}
+		}
+		center /= (c.size() / 3);
+		for (size_t k = 0; k < xy.size(); k += 2) { // shapes are centered on their origin
+			xy[k] -= center(0);
+			xy[k + 1] -= center(1);
+		}
+		stamp_shape = shapes.add_shape(xy, c);
+		stamp_source = triangles.handle(ith_triangle);
+		stamp_group = ith_group;
+	}
+	shapes.add_instance(stamp_shape, Affine2::translate(p1(0), p1(1)), NO_COLOR_OVERRIDE, triangles.animation[ith_triangle]);
+	std::cout << "Stamped shape " << stamp_shape << " (" << shapes.instance_count(stamp_shape) << " instances)." << std::endl;
+}
+
+// Record the transform and the color of the clicked triangle, or of its outermost group, as
+// keys of its tracks, one second after their last keys.
+inline void Editor::key_clicked(void) {
+	if (ith_triangle == -1) { return; }
+	bool is_group = ith_group != 0;
+	int target = is_group ? ith_group : ith_triangle;
+	const float* translation = is_group ? &groups.translation[target * 2] : &triangles.translation[target * 2];
+	const float* rotation = is_group ? &groups.rotation[target * 2] : &triangles.rotation[target * 2];
+	float scaling = is_group ? groups.scaling[target] : triangles.scaling[target];
+
+	int tracks[TRACK_CHANNELS];
+	float time = 0;
+	for (int c = 0; c < TRACK_CHANNELS; c++) {
+		tracks[c] = timeline.track(target, is_group, c);
+		time = std::max(time, timeline.end(tracks[c]) + 1);
 	}
-	for(int j = 0; j < 4; j ++) {
-		model.col(floor(i/3) * 4 + j) = model.col(triangle_count * 4 - 4 + j);
-		translation.col(floor(i/3) * 4 + j) = translation.col(triangle_count * 4 - 4 + j);
-		rotation.col(floor(i/3) * 4 + j) = rotation.col(triangle_count * 4 - 4 + j);
-		scaling.col(floor(i/3) * 4 + j) = scaling.col(triangle_count * 4 - 4 + j);
+	float angle = atan2(rotation[1], rotation[0]);
+	int r = tracks[TRACK_ROTATION];
+	if (timeline.count[r] > 0) { // turn the short way from the last key
+		float last = timeline.key_value[(timeline.first[r] + timeline.count[r] - 1) * TRACK_VALUES];
+		angle += 2 * M_PI * std::round((last - angle) / (2 * M_PI));
 	}
-	triangle_count --;
-	V.conservativeResize(4, triangle_count * 3);
-	model.conservativeResize(4, triangle_count * 4);
-	translation.conservativeResize(4, triangle_count * 4);
-	rotation.conservativeResize(4, triangle_count * 4);
-	scaling.conservativeResize(4, triangle_count * 4);
+	float values[TRACK_CHANNELS][TRACK_VALUES] = {{translation[0], translation[1], 0}, {angle, 0, 0}, {scaling, 0, 0}, {0, 0, 0}};
+	color_to_rgb(triangles.corner_color(ith_triangle, 0), values[TRACK_COLOR]);
+	for (int c = 0; c < TRACK_CHANNELS; c++) { timeline.set_key(tracks[c], time, values[c]); }
+	std::cout << "Key of " << (is_group ? "group " : "triangle ") << target << " at " << time << " s." << std::endl;
+}
+
+// Switch the tracks of the clicked triangle, or of its outermost group, between linear and cubic.
+inline void Editor::toggle_interpolation_clicked(void) {
+	if (ith_triangle == -1) { return; }
+	bool is_group = ith_group != 0;
+	int target = is_group ? ith_group : ith_triangle;
+	int k = timeline.find(target, is_group, TRACK_POSITION);
+	if (k == -1) { return; }
+	int mode = timeline.interpolation[k] == TRACK_LINEAR ? TRACK_CUBIC : TRACK_LINEAR;
+	timeline.set_interpolation(target, is_group, mode);
+	std::cout << (mode == TRACK_CUBIC ? "Cubic" : "Linear") << " keys for " << (is_group ? "group " : "triangle ") << target << "." << std::endl;
 }
 
-inline void Editor::find_closest_vertex(int from, int to, int nv) {
+// Evaluate the timeline at time and the transforms and colors it gives, over the edited ones.
+// A group track replaces the translation, rotation or scale of the group, and moves its
+// subgroups and members with it; a triangle track those of the triangle. A color track tints
+// the whole triangle, or every triangle of the group that has no color track of its own.
+inline void Editor::pose(float time) {
+	triangles.compose_dirty();
+	groups.update();
+	timeline.evaluate(time);
+	for (size_t k = 0; k < posed_list.size(); k++) {
+		posed_keyed[posed_list[k]] = 0;
+		posed_tint[posed_list[k] * 4 + 3] = 0;
+	}
+	posed_list.clear();
+	posed_model.resize(triangles.capacity);
+	posed_keyed.resize(triangles.capacity, 0);
+	posed_tint.resize(triangles.capacity * 4, 0.0f);
+
+	// The parameters tx,ty,cos,sin,scale of every target with tracks, edited ones by default.
+	int n = (int)groups.parent.size();
+	std::vector<float> group_params(n * 5);
+	std::vector<char> group_has(n, 0);
+	std::unordered_map<int, int> triangle_params; // slot -> index in params
+	std::vector<float> params;
+	group_tint.assign(n * 4, 0.0f);
+	for (int k = 0; k < timeline.size(); k++) {
+		int target = timeline.target[k];
+		const float *translation, *rotation, *scaling;
+		float* p;
+		float* tint;
+		bool fresh;
+		if (timeline.group[k]) {
+			if (target >= n || !groups.alive[target]) { continue; }
+			fresh = !group_has[target];
+			group_has[target] = 1;
+			p = &group_params[target * 5];
+			tint = &group_tint[target * 4];
+			translation = &groups.translation[target * 2];
+			rotation = &groups.rotation[target * 2];
+			scaling = &groups.scaling[target];
+		} else {
+			if (target >= triangles.slots || !triangles.alive[target]) { continue; }
+			fresh = !posed_keyed[target];
+			if (fresh) {
+				posed_keyed[target] = 1;
+				posed_list.push_back(target);
+				triangle_params[target] = (int)params.size();
+				params.resize(params.size() + 5);
+			}
+			p = &params[triangle_params[target]];
+			tint = &posed_tint[target * 4];
+			translation = &triangles.translation[target * 2];
+			rotation = &triangles.rotation[target * 2];
+			scaling = &triangles.scaling[target];
+		}
+		if (fresh) {
+			p[0] = translation[0]; p[1] = translation[1];
+			p[2] = rotation[0]; p[3] = rotation[1];
+			p[4] = scaling[0];
+		}
+		const float* v = &timeline.value[k * TRACK_VALUES];
+		int c = timeline.channel[k];
+		if (c == TRACK_POSITION) { p[0] = v[0]; p[1] = v[1]; }
+		else if (c == TRACK_ROTATION) { p[2] = cos(v[0]); p[3] = sin(v[0]); }
+		else if (c == TRACK_SCALE) { p[4] = v[0]; }
+		else {
+			std::copy(v, v + 3, tint);
+			tint[3] = 1;
+		}
+	}
+	for (size_t k = 0; k < posed_list.size(); k++) {
+		int t = posed_list[k];
+		const float* p = &params[triangle_params[t]];
+		posed_model[t] = Affine2::similarity(triangles.barycenter(t), p, p + 2, p[4]);
+	}
+
+	// Group worlds from the root down, the keyed ones and those under them composed again.
+	posed_group.resize(n);
+	group_keyed.assign(n, 0);
+	posed_group[0] = groups.world[0];
+	std::vector<int> stack(1, 0);
+	while (!stack.empty()) {
+		int g = stack.back();
+		stack.pop_back();
+		for (size_t k = 0; k < groups.children[g].size(); k++) {
+			int c = groups.children[g][k];
+			group_keyed[c] = group_keyed[g] || group_has[c];
+			if (group_has[c]) {
+				const float* p = &group_params[c * 5];
+				posed_group[c] = posed_group[g] * Affine2::similarity(groups.pivot[c], p, p + 2, p[4]);
+			}
+			else if (group_keyed[c]) { posed_group[c] = posed_group[g] * groups.local(c); }
+			else { posed_group[c] = groups.world[c]; }
+			if (group_tint[c * 4 + 3] == 0) { std::copy(&group_tint[g * 4], &group_tint[g * 4 + 4], &group_tint[c * 4]); }
+			stack.push_back(c);
+		}
+	}
+	posing = true;
+	pose_serial ++;
+
+	// The slots keyed now; those that no longer are go back to their edited place.
+	std::vector<int> last;
+	last.swap(keyed_list);
+	keyed_list = posed_list;
+	for (int g = 0; g < n; g++) {
+		if (!group_keyed[g]) { continue; }
+		for (int t = groups.first_member[g]; t != -1; t = groups.member_next[t]) {
+			if (!posed_keyed[t]) { keyed_list.push_back(t); }
+		}
+	}
+	for (size_t k = 0; k < last.size(); k++) {
+		if (!keyed(last[k])) { triangles.mark_moved(last[k]); }
+	}
+}
+
+// Back to the edited transforms and colors.
+inline void Editor::unpose(void) {
+	if (!posing) { return; }
+	posing = false;
+	for (size_t k = 0; k < keyed_list.size(); k++) { triangles.mark_moved(keyed_list[k]); }
+	keyed_list.clear();
+}
+
+// The triangle moves with the timeline while posing.
+inline bool Editor::keyed(int t) const {
+	int g = triangles.group[t];
+	return posing && ((t < (int)posed_keyed.size() && posed_keyed[t]) || (g < (int)group_keyed.size() && group_keyed[g]));
+}
+
+// World transform of triangle t, posed by the timeline while posing.
+inline Affine2 Editor::posed_world(int t) {
+	if (!keyed(t)) { return world_transform(t); }
+	int g = triangles.group[t];
+	bool own = t < (int)posed_keyed.size() && posed_keyed[t];
+	return (g < (int)group_keyed.size() && group_keyed[g] ? posed_group[g] : groups.world[g]) * (own ? posed_model[t] : triangles.model[t]);
+}
+
+// World transform of triangle t as drawn: posed, then moved by its built-in animation at the
+// time on screen, as vertex_shader.glsl does.
+inline Affine2 Editor::shown_world(int t) {
+	Affine2 world = posed_world(t);
+	int type = (mode == ANIMATION_MODE) ? (int)triangles.animation[t] : 0;
+	if (type == 0) { return world; }
+	Vector2f b = triangles.barycenter(t);
+	Vector2f pivot = (type == 7) ? b : world * b;
+	return Affine2::about(pivot, shown.at(type, std::floor(triangles.vertex(t, 0)(0) * 1000))) * world;
+}
+
+// r,g,b a color track gives triangle t while posing, NULL if none.
+inline const float* Editor::tint(int t) const {
+	if (!posing) { return NULL; }
+	if (t < (int)posed_keyed.size() && posed_tint[t * 4 + 3] != 0) { return &posed_tint[t * 4]; }
+	int g = triangles.group[t];
+	return g < (int)group_keyed.size() && group_tint[g * 4 + 3] != 0 ? &group_tint[g * 4] : NULL;
+}
+
+// Append the triangles of an OFF mesh, fitted in the [-0.8,0.8] square. Corners that
+// coincide are welded, so the mesh keeps one vertex per shared corner.
+inline bool Editor::import_off(const std::string& filename) {
+	Eigen::MatrixXd OV;
+	Eigen::MatrixXi OF;
+	if (!read_off(filename, OV, OF) || OV.rows() == 0) { return false; }
+
+	Eigen::Vector2d lo = OV.leftCols(2).colwise().minCoeff();
+	Eigen::Vector2d hi = OV.leftCols(2).colwise().maxCoeff();
+	Eigen::Vector2d center = (lo + hi) / 2;
+	double k = 1.6 / std::max((hi - lo).maxCoeff(), 1e-12);
+
+	triangles.reserve(triangles.slots + (int)OF.rows());
+	triangles.reserve_vertices(triangles.vertex_slots + (int)OV.rows());
+	float tolerance = triangles.weld_tolerance;
+	triangles.weld_tolerance = 1e-6;
+	for (int f = 0; f < OF.rows(); f++) {
+		float xy[6];
+		for (int j = 0; j < 3; j++) {
+			xy[j * 2] = (OV(OF(f, j), 0) - center(0)) * k;
+			xy[j * 2 + 1] = (OV(OF(f, j), 1) - center(1)) * k;
+		}
+		groups.add_member(0, triangles.push_back(xy, -1.0));
+	}
+	triangles.weld_tolerance = tolerance;
+	std::cout << "Imported " << OF.rows() << " triangles, " << triangles.vertex_count << " vertices in the scene." << std::endl;
+	return true;
+}
+
+// Dissolve the outermost group of the clicked triangle, baking its transform into its content.
+inline void Editor::ungroup_clicked(void) {
+	int g = ith_group;
+	if (g == 0) { return; }
+	groups.update();
+	triangles.compose_dirty();
+	Affine2 local = groups.local(g);
+	int p = groups.parent[g];
+	std::vector<int> children = groups.children[g];
+	for (size_t k = 0; k < children.size(); k++) {
+		Affine2 child = local * groups.local(children[k]);
+		groups.pivot[children[k]] = local * groups.pivot[children[k]];
+		groups.set_local(children[k], child);
+		groups.reparent(children[k], p);
+	}
+	while (groups.first_member[g] != -1) {
+		int t = groups.first_member[g];
+		triangles.set_model(t, local * triangles.model[t]);
+		triangles.set_group(t, p);
+		groups.move_member(t, g, p);
+	}
+	groups.remove(g);
+	timeline.remove_target(g, true);
+	ith_group = groups.top(triangles.group[ith_triangle]);
+	std::cout << "Ungrouped group " << g << "." << std::endl;
+}
+
+// The closest triangle corner to the cursor, as corner t*3+k, where it is drawn. The still
+// corners come from the grid; the animated triangles whose box reaches closer than the best
+// of them come from the picker, and their corners are moved to the time on screen.
+inline void Editor::find_closest_vertex(void) {
+	sync_shown();
+	sync_corners();
+	closest_vertex = corners.nearest(p1(0), p1(1), 10.0);
+	if (picker.moving_count == 0) { return; }
+	float x = p1(0), y = p1(1);
+	float best = 10.0f;
+	if (closest_vertex != -1) {
+		best = Vector2f(corners.position[closest_vertex * 2] - x, corners.position[closest_vertex * 2 + 1] - y).norm();
+	}
+	float region[4] = {x - best, y - best, x + best, y + best};
+	std::vector<int> candidates;
+	picker.tree.query(region, candidates);
+	for (size_t k = 0; k < candidates.size(); k++) {
+		int t = candidates[k];
+		if (picker.motion[t] == 0) { continue; }
+		Affine2 world = shown_world(t);
+		for (int j = 0; j < 3; j++) {
+			float d = (world * triangles.vertex(t, j) - Vector2f(x, y)).norm();
+			if (d < best) {
+				best = d;
+				closest_vertex = t * 3 + j;
+			}
+		}
+	}
+}
+
+// The closest of the four control points of the bezier curve being edited.
+inline void Editor::find_closest_control_point(void) {
 	closest_vertex = -1;
 	double dist = 10.0;
 
-	for (int i = from; i < to; i++) {
-		Eigen::Vector4f v(V(0, i), V(1, i), 0, 1);
-		if (nv == 3) { v = model.block(0, floor(i/3) * 4, 4, 4) * v; }
-		if (nv == 4) { v = MatrixXf::Identity(4, 4) * v; }
-		Eigen::Vector2d v_2d (v(0), v(1));
-
+	for (int i = 0; i < 4; i++) {
+		Eigen::Vector2d v_2d (preview(0, i), preview(1, i));
 		double d = (p1 - v_2d).norm();
 		if (d < dist) {
 			dist = d;
@@ -233,18 +1395,11 @@ inline void Editor::find_closest_vertex(int from, int to, int nv) {
 	}
 }
 
-inline void Editor::model_matrix_expand(void) {
-	triangle_count ++;
-
-	model.conservativeResize(4, triangle_count * 4);
-	translation.conservativeResize(4, triangle_count * 4);
-	rotation.conservativeResize(4, triangle_count * 4);
-	scaling.conservativeResize(4, triangle_count * 4);
-
-	model.topRightCorner(4,4).setIdentity();
-	translation.topRightCorner(4,4).setIdentity();
-	rotation.topRightCorner(4,4).setIdentity();
-	scaling.topRightCorner(4,4).setIdentity();
+// Turn the three preview vertices into a triangle of the scene.
+inline void Editor::insert_triangle(void) {
+	float xy[6] = {preview(0,0), preview(1,0), preview(0,1), preview(1,1), preview(0,2), preview(1,2)};
+	groups.add_member(0, triangles.push_back(xy, -1.0));
+	preview.resize(2, 0);
 }
 
 inline float Editor::bezier_curve(float V1, float V2, float V3, float V4, float t) {
@@ -270,55 +1425,175 @@ inline std::string Editor::color_to_hex(float c) {
 	return color;
 }
 
-inline void Editor::screenshot(const char* filename) {
+// The color of code c, as the shaders draw it.
+inline void Editor::color_to_rgb(float c, float* rgb) {
+	int k = std::max(0, std::min(PALETTE_COLORS - 1, (int)c + 1));
+	for (int j = 0; j < 3; j++) { rgb[j] = PALETTE[k][j] / 255.0f; }
+}
+
+inline std::string Editor::rgb_to_hex(const float* rgb) {
+	char buff[8];
+	snprintf(buff, sizeof(buff), "#%02X%02X%02X", (int)std::round(std::max(0.0f, std::min(1.0f, rgb[0])) * 255),
+		(int)std::round(std::max(0.0f, std::min(1.0f, rgb[1])) * 255), (int)std::round(std::max(0.0f, std::min(1.0f, rgb[2])) * 255));
+	return std::string(buff);
+}
+
+// SVG for one triangle with viewport coordinates v and vertex color codes c, or the single
+// color rgb if it is given. The gradients are c<id> and c<id+1>.
+inline std::string Editor::svg_triangle(const Vector2f* v, const float* c, int id, const float* rgb) {
+	char buff[1000];
+	Vector2f v1_ = v[0], v2_ = v[1], v3_ = v[2];
+	float max_x = std::max({v1_(0), v2_(0), v3_(0)});
+	float min_x = std::min({v1_(0), v2_(0), v3_(0)});
+	float max_y = std::max({v1_(1), v2_(1), v3_(1)});
+	float min_y = std::min({v1_(1), v2_(1), v3_(1)});
+	float triangle_width = max_x - min_x;
+	float triangle_height = max_y - min_y;
+	Vector2f normal_v1((v1_(0)-min_x)/triangle_width , (v1_(1)-min_y)/triangle_height);
+	Vector2f normal_v2((v2_(0)-min_x)/triangle_width , (v2_(1)-min_y)/triangle_height);
+	Vector2f normal_v3((v3_(0)-min_x)/triangle_width , (v3_(1)-min_y)/triangle_height);
+	Vector2f midpoint = (normal_v2 + normal_v3)/2;
+	std::string hex[3];
+	for (int k = 0; k < 3; k++) { hex[k] = rgb ? rgb_to_hex(rgb) : color_to_hex(c[k]); }
+
+	snprintf(buff, sizeof(buff),
+		"<linearGradient id='c%d' gradientUnits='objectBoundingBox' x1='%f' y1='%f' x2='%f' y2='%f'>"
+		"<stop offset='0%%' stop-color='%s'/><stop offset='100%%' stop-color='%s'/></linearGradient>\n"
+		"<linearGradient id='c%d' gradientUnits='objectBoundingBox' x1='%f' y1='%f' x2='%f' y2='%f'>"
+		"<stop offset='0%%' stop-color='%s'/><stop offset='100%%' stop-color='%s' stop-opacity='0'/></linearGradient>\n"
+		"<path d='M %f,%f  L %f,%f  %f,%f Z' fill='url(#c%d)'/><path d='M %f,%f  L %f,%f  %f,%f Z' fill='url(#c%d)'/>\n", 
+		id, normal_v2(0),normal_v2(1), normal_v3(0), normal_v3(1), hex[1].c_str(), hex[2].c_str(),
+		id+1, normal_v1(0), normal_v1(1), midpoint(0), midpoint(1), hex[0].c_str(), hex[0].c_str(),
+		v1_(0),v1_(1), v2_(0),v2_(1), v3_(0),v3_(1), id,
+		v1_(0),v1_(1), v2_(0),v2_(1), v3_(0),v3_(1), id+1);
+	return std::string(buff);
+}
+
+// The animateTransform tag of each built-in animation type and phase class, at index
+// type * ANIMATION_PHASES + phase class, in the coordinates of the file where a world unit is
+// unit long; empty for type 0. The motions repeat every 4 seconds (see AnimationTable): the
+// table is evaluated at SVG_MOTION_KEYS + 1 times evenly spread over them, from the start of
+// the file, and gives the values at those keyTimes, interpolated linearly in between. A turn
+// is kept as its angle, unwrapped from key to key, so it goes round the short way. Turns and
+// scales are about the origin, svg_motion moves the pivot there, so the tags are the same for
+// every triangle and are made once per file.
+inline std::vector<std::string> Editor::svg_motions(float unit) {
+	std::vector<std::string> values(ANIMATION_TYPES * ANIMATION_PHASES), times;
+	std::vector<float> last(values.size(), 0);
+	char buff[1000];
+	AnimationTable table;
+	for (int k = 0; k <= SVG_MOTION_KEYS; k++) {
+		float f = float(k) / SVG_MOTION_KEYS;
+		table.evaluate(4 * f, true);
+		for (int type = 1; type < ANIMATION_TYPES; type++) {
+			bool turn = (type == 1 || type == 7), slide = (type == 4 || type == 5);
+			for (int q = 0; q < ANIMATION_PHASES; q++) {
+				const Affine2& m = table.motion[type][q];
+				int i = type * ANIMATION_PHASES + q;
+				if (turn) {
+					float angle = std::atan2(m.b, m.a) * float(180 / M_PI);
+					if (k > 0) { angle += 360 * std::round((last[i] - angle) / 360); }
+					last[i] = angle;
+					snprintf(buff, sizeof(buff), "%f", angle);
+				}
+				else if (slide) { snprintf(buff, sizeof(buff), "%f %f", m.x * unit, m.y * unit); }
+				else { snprintf(buff, sizeof(buff), "%f %f", m.a, m.d); }
+				values[i] += (k ? ";" : "") + std::string(buff);
+			}
+		}
+		snprintf(buff, sizeof(buff), "%g", f);
+		times.push_back(std::string(buff));
+	}
+	std::string keys;
+	for (size_t k = 0; k < times.size(); k++) { keys += (k ? ";" : "") + times[k]; }
+	std::vector<std::string> tags(values.size());
+	for (int type = 1; type < ANIMATION_TYPES; type++) {
+		bool turn = (type == 1 || type == 7), slide = (type == 4 || type == 5);
+		for (int q = 0; q < ANIMATION_PHASES; q++) {
+			int i = type * ANIMATION_PHASES + q;
+			tags[i] = std::string("<g><animateTransform attributeName='transform' type='") + (turn ? "rotate" : (slide ? "translate" : "scale"))
+				+ "' values='" + values[i] + "' keyTimes='" + keys + "' dur='4s' repeatCount='indefinite'/>\n";
+		}
+	}
+	return tags;
+}
+
+// Opening tags of the groups that move their content as the built-in animation type does
+// at phase, about pivot, taken from the motions of svg_motions; close gets the matching end
+// tags. Nothing for type 0.
+inline std::string Editor::svg_motion(const std::vector<std::string>& motions, int type, float phase, const Vector2f& pivot, std::string& close) {
+	close = "";
+	if (type < 1 || type >= ANIMATION_TYPES) { return ""; }
+	const std::string& open = motions[type * ANIMATION_PHASES + AnimationTable::phase_class(phase)];
+	if (type == 4 || type == 5) { // a slide does not depend on the pivot
+		close = "</g>\n";
+		return open;
+	}
+	char about[200]; // a turn or a scale is about the origin, so the pivot is moved there and back
+	snprintf(about, sizeof(about), "<g transform='translate(%f,%f)'>", pivot(0), pivot(1));
+	std::string tags = about + open;
+	snprintf(about, sizeof(about), "<g transform='translate(%f,%f)'>\n", -pivot(0), -pivot(1));
+	close = "</g></g></g>\n";
+	return tags + about;
+}
+
+// Write the scene as an SVG file. The triangles are written one by one as they are made,
+// so the memory used does not grow with the scene. If animated, the triangles and instances
+// are written at rest, each wrapped in the SMIL animation of its built-in animation type (see
+// svg_motion), and the file plays them from scene time 0; the timeline is not written. The
+// frame is otherwise written as posed by the timeline, without the built-in animations.
+inline void Editor::screenshot(const char* filename, bool animated) {
+	std::ofstream file(filename);
 	char buff[1000];
 	snprintf(buff, sizeof(buff), 
 		"<svg xmlns='http://www.w3.org/2000/svg' version='1.1' width='%f' height='%f'>"
 		"<g transform='matrix(1 0 0 -1 0 %f)'>"
 		"<rect x='0' y='0' width='%f' height='%f' fill='white'/>\n",width, height, height, width, height);
-	std::string input = buff;
-	for (int i = 0; i < (triangle_count * 3); i += 3) {
-		Vector4f v1(V.col(i)(0), V.col(i)(1), 0,1);
-		Vector4f v2(V.col(i+1)(0), V.col(i+1)(1), 0,1);
-		Vector4f v3(V.col(i+2)(0), V.col(i+2)(1), 0,1);
-
-		Matrix4f viewport;
-		viewport << (width/2.0)*aspect_ratio,0,0,(width-1)/2.0,  0, height/2.0,0,(height-1)/2.0,  0,0,1,0,  0,0,0,1;
-		Vector4f v1_ = viewport * model.block(0, floor(i/3) * 4, 4, 4) * v1;
-		Vector4f v2_ = viewport * model.block(0, floor(i/3) * 4, 4, 4) * v2;
-		Vector4f v3_ = viewport * model.block(0, floor(i/3) * 4, 4, 4) * v3;
-
-		float max_x = std::max({v1_(0), v2_(0), v3_(0)});
-		float min_x = std::min({v1_(0), v2_(0), v3_(0)});
-		float max_y = std::max({v1_(1), v2_(1), v3_(1)});
-		float min_y = std::min({v1_(1), v2_(1), v3_(1)});
-		float triangle_width = max_x - min_x;
-		float triangle_height = max_y - min_y;
-		Vector2f normal_v1((v1_(0)-min_x)/triangle_width , (v1_(1)-min_y)/triangle_height);
-		Vector2f normal_v2((v2_(0)-min_x)/triangle_width , (v2_(1)-min_y)/triangle_height);
-		Vector2f normal_v3((v3_(0)-min_x)/triangle_width , (v3_(1)-min_y)/triangle_height);
-		Vector2f midpoint = (normal_v2 + normal_v3)/2;
-
-		std::string c1,c2,c3;
-		memset(buff, 0, sizeof(buff));
-		snprintf(buff, sizeof(buff),
-			"<linearGradient id='c%d' gradientUnits='objectBoundingBox' x1='%f' y1='%f' x2='%f' y2='%f'>"
-			"<stop offset='0%%' stop-color='%s'/><stop offset='100%%' stop-color='%s'/></linearGradient>\n"
-			"<linearGradient id='c%d' gradientUnits='objectBoundingBox' x1='%f' y1='%f' x2='%f' y2='%f'>"
-			"<stop offset='0%%' stop-color='%s'/><stop offset='100%%' stop-color='%s' stop-opacity='0'/></linearGradient>\n"
-			"<path d='M %f,%f  L %f,%f  %f,%f Z' fill='url(#c%d)'/><path d='M %f,%f  L %f,%f  %f,%f Z' fill='url(#c%d)'/>\n", 
-			i, normal_v2(0),normal_v2(1), normal_v3(0), normal_v3(1), color_to_hex(V(2,i+1)).c_str(), color_to_hex(V(2,i+2)).c_str(),
-			i+1, normal_v1(0), normal_v1(1), midpoint(0), midpoint(1), color_to_hex(V(2,i)).c_str(), color_to_hex(V(2,i)).c_str(),
-			v1_(0),v1_(1), v2_(0),v2_(1), v3_(0),v3_(1), i,
-			v1_(0),v1_(1), v2_(0),v2_(1), v3_(0),v3_(1), i+1);
-		std::string tri_str = buff;
-		input += tri_str;
-	}
-	input += "</g></svg>";
-    std::ofstream file(filename);
-	file << input;
+	file << buff;
+	Affine2 viewport = {float((width/2.0)*aspect_ratio), 0, 0, float(height/2.0), float((width-1)/2.0), float((height-1)/2.0)};
+	float unit = viewport.d; // the viewport scales both axes by it
+	std::string close;
+	std::vector<std::string> motions;
+	if (animated) { motions = svg_motions(unit); }
+	int id = 0;
+	for (int t = triangles.head; t != -1; t = triangles.next[t]) { // as posed by the timeline, if it is
+		Affine2 world = animated ? world_transform(t) : posed_world(t);
+		Affine2 m = viewport * world;
+		Vector2f v[3] = {m * triangles.vertex(t, 0), m * triangles.vertex(t, 1), m * triangles.vertex(t, 2)};
+		float c[3] = {triangles.corner_color(t, 0), triangles.corner_color(t, 1), triangles.corner_color(t, 2)};
+		int type = animated ? (int)triangles.animation[t] : 0;
+		if (type != 0) { // about the world barycenter, or the model one for type 7, as the shader
+			Vector2f b = triangles.barycenter(t);
+			file << svg_motion(motions, type, std::floor(triangles.vertex(t, 0)(0) * 1000), viewport * (type == 7 ? b : world * b), close);
+		}
+		file << svg_triangle(v, c, id, animated ? NULL : tint(t));
+		if (type != 0) { file << close; }
+		id += 2;
+	}
+	// Shape instances, drawn on top of the triangles like on screen.
+	for (int s = 0; s < shapes.count(); s++) {
+		for (int k = 0; k < shapes.instance_count(s); k++) {
+			const float* inst = &shapes.instances[s][k * INSTANCE_FLOATS];
+			const Affine2& model = *reinterpret_cast<const Affine2*>(inst);
+			Affine2 m = viewport * model;
+			int type = animated ? (int)inst[7] : 0;
+			if (type != 0) { // the whole instance moves as one
+				Vector2f b = shapes.barycenter[s];
+				file << svg_motion(motions, type, std::floor(shapes.position[shapes.first[s] * 2] * 1000), viewport * (type == 7 ? b : model * b), close);
+			}
+			for (int j = shapes.first[s]; j < shapes.first[s] + shapes.size[s]; j += 3) {
+				const float* xy = &shapes.position[j * 2];
+				Vector2f v[3] = {m * Vector2f(xy[0], xy[1]), m * Vector2f(xy[2], xy[3]), m * Vector2f(xy[4], xy[5])};
+				float c[3] = {shapes.color[j], shapes.color[j + 1], shapes.color[j + 2]};
+				if (inst[6] != NO_COLOR_OVERRIDE) { c[0] = c[1] = c[2] = inst[6]; }
+				file << svg_triangle(v, c, id);
+				id += 2;
+			}
+			if (type != 0) { file << close; }
+		}
+	}
+	file << "</g></svg>";
 	file.close();
 }
 
-#endif
-
+#endif
\ No newline at end of file
@@ -0,0 +1,249 @@
+#ifndef GROUPS_H
+#define GROUPS_H
+
+#include "Affine2.h"
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+
+// Nested groups of triangles. Group 0 is the scene root: it is never removed and holds
+// every triangle that is not grouped. A group carries a local transform (translation,
+// rotation and uniform scale about its pivot) relative to its parent, and caches its
+// world transform. Moving a group only marks it dirty; update() recomputes the world
+// transforms of the dirty subtrees once per frame, so dragging a group of any size is O(1).
+// The triangles directly in a group are chained in a list through their slots, and the
+// groups whose world transform changed are journaled in moved_list for the editor caches,
+// and in redrawn_list for the renderer, which keeps a table of the world transforms.
+class GroupTree {
+	public:
+		int count; // Numbers of slots in use or on the free list.
+		int free_head;
+
+		std::vector<int> parent;               // -1 for the root, the next free slot for a free one.
+		std::vector<char> alive;               // The slot holds a group, not a free one.
+		std::vector<std::vector<int> > children;
+		std::vector<int> members;              // Numbers of triangles directly in the group.
+		std::vector<int> first_member;         // First of those triangles, -1 if none.
+		std::vector<int> member_next;          // Next triangle in the same group. Per triangle slot.
+		std::vector<int> member_prev;          // Previous triangle in the same group. Per triangle slot.
+		std::vector<float> translation;        // tx,ty. 2 floats per group.
+		std::vector<float> rotation;           // cos,sin of the rotation angle. 2 floats per group.
+		std::vector<float> scaling;            // Uniform scale factor.
+		std::vector<Eigen::Vector2f> pivot;    // Center of rotation and scale, in parent space.
+		std::vector<Affine2> world;            // Cached parent world * local.
+		std::vector<char> dirty;               // The local transform changed since the last update.
+		std::vector<int> dirty_list;
+		std::vector<char> moved;               // The world transform changed since moved_list was drained.
+		std::vector<int> moved_list;
+		std::vector<char> redrawn;             // The world transform changed since redrawn_list was drained.
+		std::vector<int> redrawn_list;         // Only the top of each subtree that changed.
+
+	void init(void);
+	int create(int parent_group, const Eigen::Vector2f& p);
+	void remove(int g);
+	void reparent(int g, int new_parent);
+	void mark_dirty(int g);
+	void mark_redrawn(int g);
+	void update(void);
+	Affine2 local(int g) const;
+	void set_local(int g, const Affine2& m);
+	int top(int g) const;
+	bool contains(int g, int h) const;
+	void add_member(int g, int t);
+	void remove_member(int g, int t, std::vector<int>* freed = NULL);
+	void move_member(int t, int from, int to);
+
+	private:
+	void update_subtree(int g);
+	void unlink_member(int g, int t);
+};
+
+//Implementation
+inline void GroupTree::init(void) {
+	count = 0;
+	free_head = -1;
+	parent.clear();
+	alive.clear();
+	children.clear();
+	members.clear();
+	first_member.clear();
+	member_next.clear();
+	member_prev.clear();
+	translation.clear();
+	rotation.clear();
+	scaling.clear();
+	pivot.clear();
+	world.clear();
+	dirty.clear();
+	dirty_list.clear();
+	moved.clear();
+	moved_list.clear();
+	redrawn.clear();
+	redrawn_list.clear();
+	create(-1, Eigen::Vector2f(0, 0)); // the scene root
+}
+
+// Create an empty group with an identity transform under parent_group, pivoting on p.
+inline int GroupTree::create(int parent_group, const Eigen::Vector2f& p) {
+	int g = free_head;
+	if (g != -1) { free_head = parent[g]; }
+	else {
+		g = count ++;
+		parent.push_back(-1);
+		alive.push_back(0);
+		children.push_back(std::vector<int>());
+		members.push_back(0);
+		first_member.push_back(-1);
+		translation.resize(count * 2);
+		rotation.resize(count * 2);
+		scaling.push_back(1.0);
+		pivot.push_back(p);
+		world.push_back(Affine2::identity());
+		dirty.push_back(0);
+		moved.push_back(0);
+		redrawn.push_back(0);
+	}
+	parent[g] = -1;
+	alive[g] = 1;
+	children[g].clear();
+	members[g] = 0;
+	first_member[g] = -1;
+	translation[g * 2] = translation[g * 2 + 1] = 0.0;
+	rotation[g * 2] = 1.0;
+	rotation[g * 2 + 1] = 0.0;
+	scaling[g] = 1.0;
+	pivot[g] = p;
+	world[g] = (parent_group == -1) ? Affine2::identity() : world[parent_group];
+	dirty[g] = 0;
+	mark_redrawn(g);
+	if (parent_group != -1) { reparent(g, parent_group); }
+	return g;
+}
+
+// Free group g. Its triangles and child groups must have been moved out already.
+inline void GroupTree::remove(int g) {
+	if (g == 0) { return; }
+	std::vector<int>& siblings = children[parent[g]];
+	siblings.erase(std::find(siblings.begin(), siblings.end(), g));
+	dirty[g] = 0;
+	moved[g] = 0;
+	alive[g] = 0;
+	parent[g] = free_head;
+	free_head = g;
+}
+
+// Move g under new_parent. The local transform is kept.
+inline void GroupTree::reparent(int g, int new_parent) {
+	if (parent[g] != -1) {
+		std::vector<int>& siblings = children[parent[g]];
+		siblings.erase(std::find(siblings.begin(), siblings.end(), g));
+	}
+	parent[g] = new_parent;
+	children[new_parent].push_back(g);
+	mark_dirty(g);
+}
+
+inline void GroupTree::mark_dirty(int g) {
+	if (!dirty[g]) {
+		dirty[g] = 1;
+		dirty_list.push_back(g);
+	}
+}
+
+inline void GroupTree::mark_redrawn(int g) {
+	if (!redrawn[g]) {
+		redrawn[g] = 1;
+		redrawn_list.push_back(g);
+	}
+}
+
+// Recompute the world transforms below every dirty group, each subtree once.
+inline void GroupTree::update(void) {
+	for (size_t k = 0; k < dirty_list.size(); k++) {
+		int g = dirty_list[k];
+		if (!dirty[g]) { continue; }
+		int top_dirty = g; // a dirty ancestor recomputes this subtree anyway
+		for (int p = parent[g]; p > 0; p = parent[p]) {
+			if (dirty[p]) { top_dirty = p; }
+		}
+		update_subtree(top_dirty);
+		if (!moved[top_dirty]) {
+			moved[top_dirty] = 1;
+			moved_list.push_back(top_dirty);
+		}
+		mark_redrawn(top_dirty);
+	}
+	dirty_list.clear();
+}
+
+inline void GroupTree::update_subtree(int g) {
+	dirty[g] = 0;
+	world[g] = (parent[g] == -1) ? local(g) : world[parent[g]] * local(g);
+	for (size_t k = 0; k < children[g].size(); k++) {
+		update_subtree(children[g][k]);
+	}
+}
+
+inline Affine2 GroupTree::local(int g) const {
+	return Affine2::similarity(pivot[g], &translation[g * 2], &rotation[g * 2], scaling[g]);
+}
+
+inline void GroupTree::set_local(int g, const Affine2& m) {
+	m.decompose(pivot[g], &translation[g * 2], &rotation[g * 2], &scaling[g]);
+	mark_dirty(g);
+}
+
+// The outermost group containing g, below the root. 0 if g is the root.
+inline int GroupTree::top(int g) const {
+	while (g > 0 && parent[g] > 0) { g = parent[g]; }
+	return g;
+}
+
+// Whether group h is g or nested in g.
+inline bool GroupTree::contains(int g, int h) const {
+	for (; h != -1; h = parent[h]) {
+		if (h == g) { return true; }
+	}
+	return false;
+}
+
+// Put triangle t in g.
+inline void GroupTree::add_member(int g, int t) {
+	if (t >= (int)member_next.size()) {
+		member_next.resize(std::max(t + 1, (int)member_next.size() * 2));
+		member_prev.resize(member_next.size());
+	}
+	member_prev[t] = -1;
+	member_next[t] = first_member[g];
+	if (first_member[g] != -1) { member_prev[first_member[g]] = t; }
+	first_member[g] = t;
+	members[g] ++;
+}
+
+inline void GroupTree::unlink_member(int g, int t) {
+	if (member_prev[t] != -1) { member_next[member_prev[t]] = member_next[t]; }
+	else { first_member[g] = member_next[t]; }
+	if (member_next[t] != -1) { member_prev[member_next[t]] = member_prev[t]; }
+	members[g] --;
+}
+
+// Drop triangle t from g, and free g and its ancestors once they are empty. The freed
+// groups are appended to freed, if given.
+inline void GroupTree::remove_member(int g, int t, std::vector<int>* freed) {
+	unlink_member(g, t);
+	while (g > 0 && members[g] == 0 && children[g].empty()) {
+		int p = parent[g];
+		remove(g);
+		if (freed) { freed->push_back(g); }
+		g = p;
+	}
+}
+
+// Move triangle t from group from to group to. from is kept even if it becomes empty.
+inline void GroupTree::move_member(int t, int from, int to) {
+	unlink_member(from, t);
+	add_member(to, t);
+}
+
+#endif
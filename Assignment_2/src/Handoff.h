@@ -0,0 +1,101 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <atomic>
+#include <utility>
+
+// Lock-free handoff of data from one writer thread to one reader thread.
+//
+// SnapshotBuffer passes the latest state: the writer fills write_buffer and publishes it,
+// the reader acquires the latest published one and reads it until the next acquire. Three
+// copies let both sides work at the same time with no lock and no copy: the one being
+// written, the one being read, and the last published one in between, swapped with a
+// single atomic exchange. A state the reader did not acquire in time is skipped.
+//
+// HandoffQueue passes a stream where nothing may be skipped, in order, as an unbounded
+// linked list: push only touches the tail, pop and peek only the head.
+template <typename T>
+class SnapshotBuffer {
+	public:
+		T buffers[3];
+		std::atomic<int> middle; // Index of the copy in between, plus FRESH if published since the last acquire.
+		int back;                // Copy owned by the writer.
+		int front;               // Copy owned by the reader.
+
+		enum { FRESH = 4 };
+
+	SnapshotBuffer() : middle(1), back(0), front(2) {}
+	T& write_buffer(void) { return buffers[back]; }
+	const T& read_buffer(void) const { return buffers[front]; }
+	void publish(void);
+	bool acquire(void);
+};
+
+template <typename T>
+class HandoffQueue {
+	public:
+		struct Node {
+			T value;
+			std::atomic<Node*> next;
+			Node() : next(nullptr) {}
+		};
+		Node* head; // Already popped, owned by the reader. Its next is the first to pop.
+		Node* tail; // Last pushed, owned by the writer.
+
+	HandoffQueue() { head = tail = new Node(); }
+	~HandoffQueue();
+	void push(T value);
+	bool pop(T& out);
+	const T* peek(void) const;
+};
+
+//Implementation
+// Hand the write buffer over and take the previous middle one to write the next state in.
+template <typename T>
+inline void SnapshotBuffer<T>::publish(void) {
+	back = middle.exchange(back | FRESH) & 3;
+}
+
+// Take the latest published state, if there is a new one. Returns whether there was.
+template <typename T>
+inline bool SnapshotBuffer<T>::acquire(void) {
+	if (!(middle.load() & FRESH)) { return false; }
+	front = middle.exchange(front) & 3;
+	return true;
+}
+
+template <typename T>
+inline HandoffQueue<T>::~HandoffQueue() {
+	while (head) {
+		Node* next = head->next.load();
+		delete head;
+		head = next;
+	}
+}
+
+template <typename T>
+inline void HandoffQueue<T>::push(T value) {
+	Node* n = new Node();
+	n->value = std::move(value);
+	tail->next.store(n, std::memory_order_release);
+	tail = n;
+}
+
+template <typename T>
+inline bool HandoffQueue<T>::pop(T& out) {
+	Node* next = head->next.load(std::memory_order_acquire);
+	if (!next) { return false; }
+	out = std::move(next->value);
+	delete head;
+	head = next;
+	return true;
+}
+
+// The value pop would return, left in the queue, or nullptr if it is empty.
+template <typename T>
+inline const T* HandoffQueue<T>::peek(void) const {
+	Node* next = head->next.load(std::memory_order_acquire);
+	return next ? &next->value : nullptr;
+}
+
+#endif
@@ -2,6 +2,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#  include <fcntl.h>
+#endif
 
 void VertexArrayObject::init() {
 	glGenVertexArrays(1, &id);
@@ -33,12 +41,206 @@ void VertexBufferObject::free() {
 	check_gl_error();
 }
 
+// Grow the storage of the buffer bound to target to hold need elements of size bytes, at
+// least doubling it. Returns whether it was reallocated, which drops its content.
+static bool reserve_buffer(GLenum target, unsigned int& capacity, int need, int size) {
+	if ((unsigned int)need <= capacity) { return false; }
+	capacity = std::max((unsigned int)need, capacity * 2);
+	glBufferData(target, (GLsizeiptr)size * capacity, NULL, GL_DYNAMIC_DRAW);
+	return true;
+}
+
+// Send the dirty ranges of data (elements of size bytes, count of them) to the buffer bound
+// to target, and clear them. The ranges are sorted and those less than a page apart are merged,
+// so scattered edits cost a few calls. Returns the bytes sent.
+static size_t upload_ranges(GLenum target, const void* data, int size, int count, std::vector<int>& dirty) {
+	const int gap = 4096 / size;
+	std::vector<std::pair<int, int> > ranges;
+	for (size_t k = 0; k + 1 < dirty.size(); k += 2) {
+		int first = std::max(0, dirty[k]), last = std::min(count, dirty[k + 1]);
+		if (first < last) { ranges.push_back(std::make_pair(first, last)); }
+	}
+	dirty.clear();
+	std::sort(ranges.begin(), ranges.end());
+	size_t bytes = 0;
+	for (size_t k = 0; k < ranges.size(); ) {
+		int first = ranges[k].first, last = ranges[k].second;
+		for (k++; k < ranges.size() && ranges[k].first <= last + gap; k++) { last = std::max(last, ranges[k].second); }
+		glBufferSubData(target, (GLintptr)size * first, (GLsizeiptr)size * (last - first), (const char*)data + (size_t)size * first);
+		bytes += (size_t)size * (last - first);
+	}
+	return bytes;
+}
+
 void VertexBufferObject::update(const Eigen::MatrixXf& M) {
+	update(M.data(), M.rows(), M.cols());
+}
+
+void VertexBufferObject::update(const float* data, int rows, int cols) {
+	mark_dirty(0, cols);
+	upload(data, rows, cols);
+}
+
+void VertexBufferObject::mark_dirty(int first, int last) {
+	dirty.push_back(first);
+	dirty.push_back(last);
+}
+
+void VertexBufferObject::upload(const float* data, int rows, int cols) {
 	assert(id != 0);
 	glBindBuffer(GL_ARRAY_BUFFER, id);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*M.size(), M.data(), GL_DYNAMIC_DRAW);
-	rows = M.rows();
-	cols = M.cols();
+	if (rows != (int)this->rows) { capacity = 0; } // another layout, the columns do not line up
+	if (reserve_buffer(GL_ARRAY_BUFFER, capacity, cols, sizeof(float) * rows)) {
+		dirty.clear();
+		mark_dirty(0, cols);
+	}
+	this->rows = rows;
+	this->cols = cols;
+	if (rows > 0) { uploaded += upload_ranges(GL_ARRAY_BUFFER, data, sizeof(float) * rows, cols, dirty); }
+	else { dirty.clear(); }
+	check_gl_error();
+}
+
+void PagedBuffer::init(int page_size, int size) {
+	free();
+	this->page_size = page_size;
+	this->size = size;
+}
+
+void PagedBuffer::write(int first, const void* data, int n, int count) {
+	this->count = count;
+	pages.resize(std::max(pages.size(), (size_t)((count + page_size - 1) / page_size)), 0);
+	const char* bytes = (const char*)data;
+	for (int last = first + n; first < last; ) {
+		int p = first / page_size;
+		int end = std::min(last, (p + 1) * (int)page_size);
+		if (pages[p] == 0) { // allocated once, at its full size
+			glGenBuffers(1, &pages[p]);
+			glBindBuffer(GL_ARRAY_BUFFER, pages[p]);
+			glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)size * page_size, NULL, GL_DYNAMIC_DRAW);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, pages[p]);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)size * (first - p * page_size), (GLsizeiptr)size * (end - first), bytes);
+		uploaded += (size_t)size * (end - first);
+		bytes += (size_t)size * (end - first);
+		first = end;
+	}
+	check_gl_error();
+}
+
+void PagedBuffer::release(int p) {
+	if (p >= (int)pages.size() || pages[p] == 0) { return; }
+	glDeleteBuffers(1, &pages[p]);
+	pages[p] = 0;
+	check_gl_error();
+}
+
+void PagedBuffer::free() {
+	for (size_t p = 0; p < pages.size(); p++) {
+		if (pages[p] != 0) { glDeleteBuffers(1, &pages[p]); }
+	}
+	pages.clear();
+	count = 0;
+	check_gl_error();
+}
+
+void TextureBufferObject::init() {
+	glGenTextures(1, &id);
+	buffer = 0;
+	format = 0;
+	check_gl_error();
+}
+
+void TextureBufferObject::attach(GLuint buffer, GLenum format) {
+	if (this->buffer == buffer && this->format == format)
+		return;
+	glBindTexture(GL_TEXTURE_BUFFER, id);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+	this->buffer = buffer;
+	this->format = format;
+	check_gl_error();
+}
+
+void TextureBufferObject::bind(int unit) {
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, id);
+	check_gl_error();
+}
+
+void TextureBufferObject::free() {
+	glDeleteTextures(1, &id);
+	id = 0;
+	check_gl_error();
+}
+
+void FrameBufferObject::init() {
+	glGenFramebuffers(1, &id);
+	glGenRenderbuffers(1, &color);
+	glGenRenderbuffers(1, &depth);
+	check_gl_error();
+}
+
+void FrameBufferObject::resize(int width, int height, int samples) {
+	if (width == this->width && height == this->height && samples == this->samples)
+		return;
+	this->width = width;
+	this->height = height;
+	this->samples = samples;
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height); // the usual window format
+	glBindFramebuffer(GL_FRAMEBUFFER, id);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "Incomplete framebuffer " << width << "x" << height << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_gl_error();
+}
+
+void FrameBufferObject::bind(bool bound) {
+	glBindFramebuffer(GL_FRAMEBUFFER, bound ? id : 0);
+	check_gl_error();
+}
+
+void FrameBufferObject::blit() {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, id);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	check_gl_error();
+}
+
+void FrameBufferObject::free() {
+	glDeleteRenderbuffers(1, &color);
+	glDeleteRenderbuffers(1, &depth);
+	glDeleteFramebuffers(1, &id);
+	id = color = depth = 0;
+	width = height = samples = 0;
+	check_gl_error();
+}
+
+void UniformBufferObject::init(GLuint binding, int size) {
+	this->binding = binding;
+	this->size = size;
+	glGenBuffers(1, &id);
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, id);
+	check_gl_error();
+}
+
+void UniformBufferObject::update(const void* data) {
+	assert(id != 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, id);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	check_gl_error();
+}
+
+void UniformBufferObject::free() {
+	glDeleteBuffers(1, &id);
+	id = 0;
 	check_gl_error();
 }
 
@@ -51,8 +253,10 @@ bool Program::init(
 	vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_filename);
 	fragment_shader = create_shader_helper(GL_FRAGMENT_SHADER, fragment_shader_filename);
 
-	if (!vertex_shader || !fragment_shader)
-	return false;
+	if (!vertex_shader || !fragment_shader) {
+		free();
+		return false;
+	}
 
 	program_shader = glCreateProgram();
 
@@ -69,11 +273,12 @@ bool Program::init(
 		char buffer[512];
 		glGetProgramInfoLog(program_shader, 512, NULL, buffer);
 		cerr << "Linker error: " << endl << buffer << endl;
-		program_shader = 0;
+		free();
 		return false;
 	}
 
 	check_gl_error();
+	reflect();
 	return true;
 }
 
@@ -82,15 +287,73 @@ void Program::bind() {
 	check_gl_error();
 }
 
-GLint Program::attrib(const std::string &name) const {
-	return glGetAttribLocation(program_shader, name.c_str());
+// The lookups search the small tables filled by reflect, no GL call and no allocation.
+GLint Program::attrib(const char* name) const {
+	for (size_t k = 0; k < attributes.size(); k++) {
+		if (strcmp(attributes[k].name.c_str(), name) == 0) {
+			attributes[k].hits ++;
+			return attributes[k].location;
+		}
+	}
+	misses ++;
+	return -1;
+}
+
+GLint Program::uniform(const char* name) const {
+	for (size_t k = 0; k < uniforms.size(); k++) {
+		if (strcmp(uniforms[k].name.c_str(), name) == 0) {
+			uniforms[k].hits ++;
+			return uniforms[k].location;
+		}
+	}
+	misses ++;
+	return -1;
+}
+
+bool Program::uniform_block(const char* name, const UniformBufferObject& UBO) const {
+	GLuint index = glGetUniformBlockIndex(program_shader, name);
+	if (index == GL_INVALID_INDEX)
+		return false;
+	glUniformBlockBinding(program_shader, index, UBO.binding);
+	check_gl_error();
+	return true;
 }
 
-GLint Program::uniform(const std::string &name) const {
-	return glGetUniformLocation(program_shader, name.c_str());
+void Program::print_lookups() const {
+	for (size_t k = 0; k < uniforms.size(); k++)
+		std::cout << "uniform " << uniforms[k].name << ": " << uniforms[k].hits << std::endl;
+	for (size_t k = 0; k < attributes.size(); k++)
+		std::cout << "attribute " << attributes[k].name << ": " << attributes[k].hits << std::endl;
+	std::cout << "inactive names: " << misses << std::endl;
 }
 
-GLint Program::bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const {
+void Program::reflect() {
+	uniforms.clear();
+	attributes.clear();
+	for (int pass = 0; pass < 2; pass++) {
+		GLint count = 0;
+		glGetProgramiv(program_shader, pass == 0 ? GL_ACTIVE_UNIFORMS : GL_ACTIVE_ATTRIBUTES, &count);
+		for (GLint k = 0; k < count; k++) {
+			char name[256];
+			GLsizei length = 0;
+			Variable v;
+			if (pass == 0)
+				glGetActiveUniform(program_shader, k, sizeof(name), &length, &v.size, &v.type, name);
+			else
+				glGetActiveAttrib(program_shader, k, sizeof(name), &length, &v.size, &v.type, name);
+			v.name = std::string(name, length);
+			if (v.name.size() > 3 && v.name.compare(v.name.size() - 3, 3, "[0]") == 0)
+				v.name.resize(v.name.size() - 3);
+			v.location = (pass == 0) ? glGetUniformLocation(program_shader, name) : glGetAttribLocation(program_shader, name);
+			v.hits = 0;
+			(pass == 0 ? uniforms : attributes).push_back(v);
+		}
+	}
+	misses = 0;
+	check_gl_error();
+}
+
+GLint Program::bindVertexAttribArray(const char* name, VertexBufferObject& VBO) const {
 	GLint id = attrib(name);
 	if (id < 0)
 		return id;
@@ -106,6 +369,44 @@ GLint Program::bindVertexAttribArray(const std::string &name, VertexBufferObject
 	return id;
 }
 
+GLint Program::bindVertexAttribArray(const char* name, GLuint buffer, int rows) const {
+	GLint id = attrib(name);
+	if (id < 0)
+		return id;
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(id);
+	glVertexAttribPointer(id, rows, GL_FLOAT, GL_FALSE, 0, 0);
+	check_gl_error();
+
+	return id;
+}
+
+GLint Program::bindInstanceAttribArray(const char* name, VertexBufferObject& VBO, int size, int columns, int offset) const {
+	GLint id = attrib(name);
+	if (id < 0 || VBO.id == 0)
+		return id;
+	VBO.bind();
+	for (int k = 0; k < columns; k++) {
+		glEnableVertexAttribArray(id + k);
+		glVertexAttribPointer(id + k, size, GL_FLOAT, GL_FALSE, sizeof(float)*VBO.rows, (void*)(sizeof(float)*(offset + k*size)));
+		glVertexAttribDivisor(id + k, 1);
+	}
+	check_gl_error();
+
+	return id;
+}
+
+void Program::unbindInstanceAttribArray(const char* name, int columns) const {
+	GLint id = attrib(name);
+	if (id < 0)
+		return;
+	for (int k = 0; k < columns; k++) {
+		glVertexAttribDivisor(id + k, 0);
+		glDisableVertexAttribArray(id + k);
+	}
+	check_gl_error();
+}
+
 void Program::free() {
 	if (program_shader) {
 		glDeleteProgram(program_shader);
@@ -143,6 +444,9 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_filen
 	std::string shader_string = read_glsl_file(shader_filename);
 	if (shader_string.empty())
 		return (GLuint) 0;
+	size_t version = shader_string.find('\n');
+	if (type == GL_VERTEX_SHADER && !prelude.empty() && version != std::string::npos) // #line keeps the errors on the lines of the file
+		shader_string.insert(version + 1, prelude + "#line 2\n");
 
 	GLuint id = glCreateShader(type);
 	const char *shader_string_const = shader_string.c_str();
@@ -163,6 +467,7 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_filen
 		cerr << shader_string << endl << endl;
 		glGetShaderInfoLog(id, 512, NULL, buffer);
 		cerr << "Error: " << endl << buffer << endl;
+		glDeleteShader(id);
 		return (GLuint) 0;
 	}
 	check_gl_error();
@@ -170,6 +475,106 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_filen
 	return id;
 }
 
+void ProgramCache::init(const std::string &prelude) {
+	this->prelude = prelude;
+#ifdef __linux__
+	notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify_fd < 0)
+		std::cerr << "Shader hot reload is off: inotify is unavailable." << std::endl;
+#endif
+}
+
+Program& ProgramCache::get(
+	const std::string &vertex_shader_filename,
+	const std::string &fragment_shader_filename,
+	const std::string &fragment_data_name)
+{
+	std::string key = vertex_shader_filename + "|" + fragment_shader_filename;
+	std::map<std::string, Entry>::iterator it = programs.find(key);
+	if (it != programs.end())
+		return it->second.program;
+
+	Entry& entry = programs[key];
+	entry.vertex_shader_filename = vertex_shader_filename;
+	entry.fragment_shader_filename = fragment_shader_filename;
+	entry.fragment_data_name = fragment_data_name;
+	entry.program.prelude = prelude;
+	entry.program.init(vertex_shader_filename, fragment_shader_filename, fragment_data_name);
+	watch(vertex_shader_filename);
+	watch(fragment_shader_filename);
+	return entry.program;
+}
+
+// Watch the directory of filename rather than the file, so editors that save by
+// writing a new file and renaming it over the old one are seen too.
+void ProgramCache::watch(const std::string &filename) {
+#ifdef __linux__
+	if (notify_fd < 0)
+		return;
+	size_t slash = filename.find_last_of('/');
+	std::string dir = (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+	for (std::map<int, std::string>::iterator it = watched.begin(); it != watched.end(); ++it)
+		if (it->second == dir)
+			return;
+	int wd = inotify_add_watch(notify_fd, dir.empty() ? "." : dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd >= 0)
+		watched[wd] = dir;
+#endif
+}
+
+bool ProgramCache::poll() {
+	bool replaced = false;
+#ifdef __linux__
+	if (notify_fd < 0)
+		return false;
+	std::vector<std::string> changed;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while ((n = read(notify_fd, buffer, sizeof(buffer))) > 0) {
+		for (char* p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			struct inotify_event* event = (struct inotify_event*)p;
+			if (event->len > 0 && watched.count(event->wd))
+				changed.push_back(watched[event->wd] + event->name);
+		}
+	}
+	if (changed.empty())
+		return false;
+
+	for (std::map<std::string, Entry>::iterator it = programs.begin(); it != programs.end(); ++it) {
+		Entry& entry = it->second;
+		bool touched = false;
+		for (size_t k = 0; k < changed.size(); k++)
+			touched = touched || changed[k] == entry.vertex_shader_filename || changed[k] == entry.fragment_shader_filename;
+		if (!touched)
+			continue;
+		Program fresh;
+		fresh.prelude = prelude;
+		if (fresh.init(entry.vertex_shader_filename, entry.fragment_shader_filename, entry.fragment_data_name)) {
+			entry.program.free();
+			entry.program = fresh;
+			reloads ++;
+			replaced = true;
+			std::cout << "Reloaded " << entry.vertex_shader_filename << " and " << entry.fragment_shader_filename << "." << std::endl;
+		} else {
+			std::cerr << "Keeping the last good program for " << it->first << "." << std::endl;
+		}
+	}
+#endif
+	return replaced;
+}
+
+void ProgramCache::free() {
+	for (std::map<std::string, Entry>::iterator it = programs.begin(); it != programs.end(); ++it)
+		it->second.program.free();
+	programs.clear();
+#ifdef __linux__
+	if (notify_fd >= 0)
+		close(notify_fd);
+#endif
+	notify_fd = -1;
+	watched.clear();
+}
+
 void _check_gl_error(const char *file, int line) {
 	GLenum err (glGetError());
 
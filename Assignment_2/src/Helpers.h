@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <Eigen/Core>
 
 #ifdef _WIN32
@@ -39,6 +40,9 @@ public:
 	void free();
 };
 
+// The buffer objects keep a capacity that grows geometrically, so the storage is only
+// reallocated when it grows, and a list of dirty ranges: upload sends those ranges with
+// glBufferSubData, and update sends everything. uploaded counts the bytes sent.
 class VertexBufferObject {
 public:
 	typedef unsigned int GLuint;
@@ -47,29 +51,139 @@ public:
 	GLuint id;
 	GLuint rows;
 	GLuint cols;
+	GLuint capacity;         // Columns the storage can hold
+	std::vector<int> dirty;  // Column ranges first,last (exclusive) changed since the last upload
+	size_t uploaded;         // Bytes sent to the GPU, reset by the caller
 
-	VertexBufferObject() : id(0), rows(0), cols(0) {}
+	VertexBufferObject() : id(0), rows(0), cols(0), capacity(0), uploaded(0) {}
 	// Create a new empty VBO
 	void init();
 	// Updates the VBO with a matrix M
 	void update(const Eigen::MatrixXf& M);
+	// Updates the VBO with cols vertices of rows floats each, read from data
+	void update(const float* data, int rows, int cols);
+	// Columns [first, last) of the data changed
+	void mark_dirty(int first, int last);
+	// Sends the dirty columns of data, everything if the storage had to grow
+	void upload(const float* data, int rows, int cols);
 	// Select this VBO for subsequent draw calls
 	void bind();
 	// Release the id
 	void free();
 };
 
+// Storage split in pages of page_size elements, each its own buffer object allocated at its
+// full size when first written: growth adds pages and never copies what is stored, and an
+// edit is only sent to its page. A page nothing refers to any more is released, and allocated
+// again by the next write to it.
+class PagedBuffer {
+public:
+	typedef unsigned int GLuint;
+
+	GLuint page_size;            // Elements per page
+	GLuint size;                 // Bytes per element
+	GLuint count;                // Elements in use, over all the pages
+	std::vector<GLuint> pages;   // Buffer object of each page, 0 if it is not allocated
+	size_t uploaded;             // Bytes sent to the GPU, reset by the caller
+
+	PagedBuffer() : page_size(0), size(0), count(0), uploaded(0) {}
+	// Set up an empty storage of elements of size bytes
+	void init(int page_size, int size);
+	// Sends the n elements of data to the elements [first, first + n), with count in use
+	void write(int first, const void* data, int n, int count);
+	// Free the buffer object of page p, whose elements are no longer used
+	void release(int p);
+	// Release the pages
+	void free();
+};
+
+// A buffer texture: lets a shader read a buffer object with texelFetch
+class TextureBufferObject {
+public:
+	typedef unsigned int GLuint;
+	typedef unsigned int GLenum;
+
+	GLuint id;
+	GLuint buffer;  // Buffer object it reads, 0 if none
+	GLenum format;  // Internal format of the texels, e.g. GL_RGBA32F
+
+	TextureBufferObject() : id(0), buffer(0), format(0) {}
+	// Create a new texture
+	void init();
+	// Read the buffer object buffer as texels of the given format
+	void attach(GLuint buffer, GLenum format);
+	// Bind it to a texture unit
+	void bind(int unit);
+	// Release the id
+	void free();
+};
+
+// An offscreen color and depth target, with as many samples as the window so it can be
+// copied to it with glBlitFramebuffer
+class FrameBufferObject {
+public:
+	typedef unsigned int GLuint;
+
+	GLuint id;
+	GLuint color;   // Renderbuffers
+	GLuint depth;
+	int width, height, samples;
+
+	FrameBufferObject() : id(0), color(0), depth(0), width(0), height(0), samples(0) {}
+	// Create the framebuffer, its storage is allocated by resize
+	void init();
+	// (Re)allocate the storage if the size or the samples changed
+	void resize(int width, int height, int samples);
+	// Draw into it, or into the window when bound is false
+	void bind(bool bound = true);
+	// Copy the color and the depth to the window
+	void blit();
+	// Release the ids
+	void free();
+};
+
+// A std140 uniform block shared by the programs that declare it, updated once per frame
+class UniformBufferObject {
+public:
+	typedef unsigned int GLuint;
+
+	GLuint id;
+	GLuint binding; // Binding point the block is attached to
+	int size;       // Bytes
+
+	UniformBufferObject() : id(0), binding(0), size(0) {}
+	// Create a buffer of size bytes attached to the binding point
+	void init(GLuint binding, int size);
+	// Replace its content with size bytes read from data
+	void update(const void* data);
+	// Release the id
+	void free();
+};
+
 // This class wraps an OpenGL program composed of two shaders
 class Program {
 public:
 	typedef unsigned int GLuint;
 	typedef int GLint;
 
+	// An active uniform or attribute, reflected when the program is linked
+	struct Variable {
+		std::string name; // Without the "[0]" of arrays
+		GLint location;   // -1 for the members of uniform blocks
+		GLuint type;
+		GLint size;
+		mutable long long hits; // Lookups of this name, for profiling
+	};
+
 	GLuint vertex_shader;
 	GLuint fragment_shader;
 	GLuint program_shader;
+	std::vector<Variable> uniforms;
+	std::vector<Variable> attributes;
+	mutable long long misses; // Lookups of names that are not active
+	std::string prelude;      // GLSL inserted after the #version line of the vertex shader
 
-	Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
+	Program() : vertex_shader(0), fragment_shader(0), program_shader(0), misses(0) { }
 
 	// Create a new shader from the specified source strings
 	bool init(const std::string vertex_shader_filename,
@@ -81,15 +195,61 @@ public:
 	// Release all OpenGL objects
 	void free();
 	// Return the OpenGL handle of a named shader attribute (-1 if it does not exist)
-	GLint attrib(const std::string &name) const;
+	GLint attrib(const char* name) const;
 	// Return the OpenGL handle of a uniform attribute (-1 if it does not exist)
-	GLint uniform(const std::string &name) const;
+	GLint uniform(const char* name) const;
+	// Attach the named uniform block to the binding point of a UBO (false if it does not exist)
+	bool uniform_block(const char* name, const UniformBufferObject& UBO) const;
+	// Print the lookup counts of the reflected uniforms and attributes
+	void print_lookups() const;
 	// Bind a per-vertex array attribute
-	GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
+	GLint bindVertexAttribArray(const char* name, VertexBufferObject& VBO) const;
+	// Same, for a buffer object of rows floats per vertex, e.g. a page of a PagedBuffer
+	GLint bindVertexAttribArray(const char* name, GLuint buffer, int rows) const;
+	// Bind a per-instance attribute: columns consecutive slots of size floats, starting offset
+	// floats into the current instance. Each instance is one column of the VBO.
+	GLint bindInstanceAttribArray(const char* name, VertexBufferObject& VBO, int size, int columns, int offset) const;
+	// Disable a per-instance attribute bound with bindInstanceAttribArray
+	void unbindInstanceAttribArray(const char* name, int columns) const;
 	GLuint create_shader_helper(GLint type, const std::string &shader_filename);
+	// Fill uniforms and attributes from the linked program
+	void reflect();
 	std::string read_glsl_file(const std::string &pathToFile);
 };
 
+// Programs compiled once and kept by shader file names. On Linux the directories of the
+// shader files are watched with inotify, and poll() relinks the programs whose files were
+// written since the last call. A program that fails to build keeps its last good version.
+class ProgramCache {
+public:
+	struct Entry {
+		std::string vertex_shader_filename;
+		std::string fragment_shader_filename;
+		std::string fragment_data_name;
+		Program program;
+	};
+
+	int notify_fd;               // inotify instance, -1 if files are not watched
+	std::map<int, std::string> watched; // watch descriptor -> directory with a trailing '/', or ""
+	std::map<std::string, Entry> programs; // by "vertex|fragment" file names
+	int reloads;                 // Numbers of successful reloads
+	std::string prelude;         // Given to every program, see Program::prelude
+
+	ProgramCache() : notify_fd(-1), reloads(0) {}
+	// Start watching; without it, get() still caches but nothing is reloaded
+	void init(const std::string &prelude = "");
+	// The program built from the two shader files, compiled on the first call only
+	Program& get(const std::string &vertex_shader_filename,
+	const std::string &fragment_shader_filename,
+	const std::string &fragment_data_name);
+	// Rebuild the programs whose files changed. Returns true if any program was replaced,
+	// which moves its attribute and uniform locations
+	bool poll();
+	// Release every program and stop watching
+	void free();
+	void watch(const std::string &filename);
+};
+
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
 void _check_gl_error(const char *file, int line);
 
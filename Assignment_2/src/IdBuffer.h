@@ -0,0 +1,146 @@
+#ifndef ID_BUFFER_H
+#define ID_BUFFER_H
+
+#include "Picking.h"
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+// CPU picking cache: the slot of the topmost triangle under every pixel of the window,
+// -1 where there is none. It is rasterized from the edge functions of a TrianglePicker,
+// and kept until the still scene changes (its still_version), the view or the window size,
+// so a pick at hover rate is one array read. The slots that move are left out, the picker
+// tests them at the time of the frame (see Editor::hover_at). The window is cut in horizontal bands, one per
+// thread, and each band rasterizes the triangles the bounds tree finds over it; every
+// pixel keeps the highest draw order, so the bands need no ordering between them.
+class IdBuffer {
+	public:
+		int width, height;
+		std::vector<int> ids;     // width * height slots, row 0 at the bottom like the pixels.
+		Eigen::Matrix4f view;     // View the buffer was rasterized with.
+		unsigned version;         // Picker still_version it was rasterized from.
+		bool valid;
+		int threads;
+		long long hits;           // Lookups answered from the buffer.
+		long long misses;         // Lookups that had to rasterize it first.
+
+	void init(void);
+	void invalidate(void);
+	int lookup(const TrianglePicker& picker, const Eigen::Matrix4f& v, int px, int py, int w, int h);
+
+	private:
+	void rasterize(const TrianglePicker& picker);
+	void rasterize_band(const TrianglePicker& picker, int y0, int y1);
+};
+
+//Implementation
+inline void IdBuffer::init(void) {
+	width = height = 0;
+	ids.clear();
+	view.setIdentity();
+	version = 0;
+	valid = false;
+	threads = std::max(1, (int)std::thread::hardware_concurrency());
+	hits = misses = 0;
+}
+
+inline void IdBuffer::invalidate(void) {
+	valid = false;
+}
+
+// Slot of the topmost triangle at pixel px,py of a w x h window seen through v, -1 if none.
+// The picker must be up to date (see TrianglePicker::update).
+inline int IdBuffer::lookup(const TrianglePicker& picker, const Eigen::Matrix4f& v, int px, int py, int w, int h) {
+	if (!valid || w != width || h != height || v != view || picker.still_version != version) {
+		misses ++;
+		width = w;
+		height = h;
+		view = v;
+		version = picker.still_version;
+		rasterize(picker);
+		valid = true;
+	} else { hits ++; }
+	if (px < 0 || py < 0 || px >= width || py >= height) { return -1; }
+	return ids[py * width + px];
+}
+
+inline void IdBuffer::rasterize(const TrianglePicker& picker) {
+	ids.assign((size_t)width * height, -1);
+	int n = std::max(1, std::min(threads, height / 16));
+	std::vector<std::thread> workers;
+	for (int k = 1; k < n; k++) {
+		workers.push_back(std::thread(&IdBuffer::rasterize_band, this, std::cref(picker), height * k / n, height * (k + 1) / n));
+	}
+	rasterize_band(picker, 0, height / n);
+	for (size_t k = 0; k < workers.size(); k++) { workers[k].join(); }
+}
+
+// Rasterize the rows [y0, y1). Pixel px,py stands for the world point that
+// Editor::pixel_to_world_coord gives for it, which is affine in px,py.
+inline void IdBuffer::rasterize_band(const TrianglePicker& picker, int y0, int y1) {
+	if (y0 >= y1 || width == 0) { return; }
+	Eigen::Matrix4f inverse = view.inverse();
+	Eigen::Vector4f origin = inverse * Eigen::Vector4f(-1, -1, 0, 1);
+	Eigen::Vector4f step_x = inverse * Eigen::Vector4f(2.0f / width, 0, 0, 0);
+	Eigen::Vector4f step_y = inverse * Eigen::Vector4f(0, 2.0f / height, 0, 0);
+
+	float band[4]; // world box of the band
+	band[0] = band[1] = 1e30f;
+	band[2] = band[3] = -1e30f;
+	for (int k = 0; k < 4; k++) {
+		Eigen::Vector4f c = origin + step_x * ((k & 1) ? width : 0) + step_y * ((k & 2) ? y1 : y0);
+		band[0] = std::min(band[0], c(0)); band[1] = std::min(band[1], c(1));
+		band[2] = std::max(band[2], c(0)); band[3] = std::max(band[3], c(1));
+	}
+	std::vector<int> candidates;
+	picker.tree.query(band, candidates);
+
+	Eigen::Matrix2f to_pixel; // world offset from origin -> pixel offset
+	to_pixel << step_x(0), step_y(0), step_x(1), step_y(1);
+	to_pixel = to_pixel.inverse().eval();
+	std::vector<unsigned> top((size_t)width * (y1 - y0), 0); // draw order of ids in the band
+	for (size_t c = 0; c < candidates.size(); c++) {
+		int t = candidates[c];
+		if (picker.moving(t)) { continue; }
+		unsigned key = picker.order[t];
+		const float* b = &picker.box[t * 4];
+		float lo[2] = {1e30f, 1e30f}, hi[2] = {-1e30f, -1e30f};
+		for (int k = 0; k < 4; k++) { // pixel box of the triangle box
+			Eigen::Vector2f w((k & 1) ? b[2] : b[0], (k & 2) ? b[3] : b[1]);
+			Eigen::Vector2f p = to_pixel * (w - origin.head<2>());
+			lo[0] = std::min(lo[0], p(0)); lo[1] = std::min(lo[1], p(1));
+			hi[0] = std::max(hi[0], p(0)); hi[1] = std::max(hi[1], p(1));
+		}
+		int xa = std::max(0, (int)std::ceil(lo[0])), xb = std::min(width - 1, (int)std::floor(hi[0]));
+		int ya = std::max(y0, (int)std::ceil(lo[1])), yb = std::min(y1 - 1, (int)std::floor(hi[1]));
+		if (xa > xb || ya > yb) { continue; }
+
+		float e[3][3]; // edge functions in pixel coordinates: E = A*px + B*py + C
+		for (int k = 0; k < 3; k++) {
+			float A = picker.edge[k * 3][t], B = picker.edge[k * 3 + 1][t], C = picker.edge[k * 3 + 2][t];
+			e[k][0] = A * step_x(0) + B * step_x(1);
+			e[k][1] = A * step_y(0) + B * step_y(1);
+			e[k][2] = A * origin(0) + B * origin(1) + C;
+		}
+		for (int py = ya; py <= yb; py++) {
+			int* row = &ids[(size_t)py * width];
+			unsigned* row_top = &top[(size_t)(py - y0) * width];
+			for (int px = xa; px <= xb; px++) {
+				float e0 = e[0][0] * px + e[0][1] * py + e[0][2];
+				float e1 = e[1][0] * px + e[1][1] * py + e[1][2];
+				float e2 = e[2][0] * px + e[2][1] * py + e[2][2];
+				bool inside = (e0 > 0 && e1 > 0 && e2 > 0) || (e0 < 0 && e1 < 0 && e2 < 0);
+				if (inside && key > row_top[px]) {
+					row_top[px] = key;
+					row[px] = t;
+				}
+			}
+		}
+	}
+}
+
+#endif
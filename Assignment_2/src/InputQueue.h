@@ -0,0 +1,63 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <vector>
+
+#define INPUT_MOVE 0   // Cursor moved to x,y.
+#define INPUT_BUTTON 1 // Mouse button, action, mods.
+#define INPUT_KEY 2    // Key, scancode, action, mods.
+
+struct InputEvent {
+	int type;
+	double x, y;
+	int code, scancode, action, mods; // code is the button or the key
+};
+
+// The input received by the GLFW callbacks, kept in order until the main loop applies it
+// once per frame. A cursor move right after another one replaces it, so any number of
+// moves between two clicks or keys comes down to one update of the editor state.
+class InputQueue {
+	public:
+		std::vector<InputEvent> events;
+		long long received;  // Events received from GLFW.
+		long long coalesced; // Moves merged into the previous one.
+
+	void init(void);
+	void move(double x, double y);
+	void button(int button, int action, int mods);
+	void key(int key, int scancode, int action, int mods);
+	bool empty(void) const { return events.empty(); }
+	void clear(void) { events.clear(); }
+};
+
+//Implementation
+inline void InputQueue::init(void) {
+	events.clear();
+	received = coalesced = 0;
+}
+
+inline void InputQueue::move(double x, double y) {
+	received ++;
+	if (!events.empty() && events.back().type == INPUT_MOVE) {
+		events.back().x = x;
+		events.back().y = y;
+		coalesced ++;
+		return;
+	}
+	InputEvent event = {INPUT_MOVE, x, y, 0, 0, 0, 0};
+	events.push_back(event);
+}
+
+inline void InputQueue::button(int button, int action, int mods) {
+	received ++;
+	InputEvent event = {INPUT_BUTTON, 0, 0, button, 0, action, mods};
+	events.push_back(event);
+}
+
+inline void InputQueue::key(int key, int scancode, int action, int mods) {
+	received ++;
+	InputEvent event = {INPUT_KEY, 0, 0, key, scancode, action, mods};
+	events.push_back(event);
+}
+
+#endif
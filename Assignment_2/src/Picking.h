@@ -0,0 +1,284 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include "Affine2.h"
+#include "BoundsTree.h"
+#include "Animation.h"
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#define PICK_BATCH 256 // Slots changed at once above which the tree is refit in one batch.
+#define PICK_LANES 8   // Candidates tested together by TrianglePicker::pick.
+
+// Point-in-triangle picking over per-slot cached data. For every triangle slot the picker
+// keeps the three edge functions of the triangle in world space, that is the model space
+// edges with the inverse world transform folded in, so a click is tested with three
+// multiply-adds per edge, no solve and no allocation. The candidates for a click come from
+// a BoundsTree over the world boxes of the triangles, so only the few triangles around the
+// click are tested, gathered PICK_LANES at a time into lane arrays. Changed slots are queued by refresh and clear and applied to the tree
+// by update: one by one for an edit, in one batch for a large move (BoundsTree::move_many),
+// with a bulk rebuild when most of the scene changed.
+//
+// A slot can move as drawn. Posed by the timeline, it is cached at its pose like any other.
+// With a built-in animation, it is cached at rest and its box is grown to all the places the
+// animation takes it, which do not depend on the time: the disk about the pivot for a turn,
+// the mirrored extent for a flip, one unit each way for a slide, half again for the pulse. So
+// the tree holds for every time, and a click is moved back by the inverse of the motion of
+// the frame (see AnimationTable) before the edge test. The slots that move are left out of
+// still_version, so the caches of the still scene (IdBuffer, ViewCuller) outlive a pose.
+class TrianglePicker {
+	public:
+		int capacity;                // Numbers of slots the arrays can hold.
+		unsigned version;            // Bumped by every update that changed a slot.
+		std::vector<float> edge[9];    // A,B,C of the edges E(p) = A*x + B*y + C, one array each.
+		std::vector<unsigned> order;   // Draw order key of the triangle, 0 for a free slot.
+		std::vector<float> box;        // xmin,ymin,xmax,ymax of each triangle in world space.
+		BoundsTree tree;               // Over box, for the slots with a nonzero order.
+		std::vector<unsigned char> motion; // Built-in animation type of the slot as drawn, 0 if none.
+		std::vector<unsigned char> posed;  // The slot is cached at a pose of the timeline.
+		std::vector<unsigned char> phase;  // Phase class of the animation.
+		std::vector<float> pivot;          // x,y the animation moves the slot about.
+		int moving_count;                  // Slots with a motion or a pose.
+		unsigned still_version;            // Bumped by the updates that changed a slot that does not move.
+		bool still_changed;
+		std::vector<char> pending;     // The slot changed since update.
+		std::vector<int> pending_list;
+		mutable std::vector<int> candidates; // Scratch list for pick.
+
+	void init(void);
+	void reserve(int n);
+	void refresh(int i, const Affine2& world, const Eigen::Vector2f* v, unsigned draw_order, int type = 0, bool is_posed = false);
+	void clear(int i);
+	void update(void);
+	bool moving(int i) const { return motion[i] != 0 || posed[i] != 0; }
+	bool hit(int i, float x, float y) const;
+	float area(int i) const;
+	bool unmove(int i, const AnimationTable& table, float* x, float* y) const;
+	int pick(float x, float y, const AnimationTable& table, bool moving_only = false) const;
+
+	private:
+	void mark_pending(int i);
+	void set_moving(int i, int type, bool is_posed);
+};
+
+//Implementation
+inline void TrianglePicker::init(void) {
+	capacity = 0;
+	version = 1;
+	still_version = 1;
+	still_changed = false;
+	moving_count = 0;
+	for (int k = 0; k < 9; k++) { edge[k].clear(); }
+	order.clear();
+	box.clear();
+	motion.clear();
+	posed.clear();
+	phase.clear();
+	pivot.clear();
+	tree.init();
+	pending.clear();
+	pending_list.clear();
+}
+
+// The new slots are zero, so they never hit until refreshed.
+inline void TrianglePicker::reserve(int n) {
+	if (n <= capacity) { return; }
+	capacity = n;
+	for (int k = 0; k < 9; k++) { edge[k].resize(capacity, 0.0f); }
+	order.resize(capacity, 0);
+	box.resize(capacity * 4, 0.0f);
+	motion.resize(capacity, 0);
+	posed.resize(capacity, 0);
+	phase.resize(capacity, 0);
+	pivot.resize(capacity * 2, 0.0f);
+	pending.resize(capacity, 0);
+}
+
+// Cache slot i for the triangle with model space vertices v, world transform and draw order,
+// moved as drawn by the built-in animation type, and posed by the timeline if is_posed.
+inline void TrianglePicker::refresh(int i, const Affine2& world, const Eigen::Vector2f* v, unsigned draw_order, int type, bool is_posed) {
+	Eigen::Vector2f w[3] = {world * v[0], world * v[1], world * v[2]};
+	for (int k = 0; k < 3; k++) { // edge from w[k] to w[k+1], positive on its left
+		const Eigen::Vector2f& a = w[k];
+		const Eigen::Vector2f& b = w[(k + 1) % 3];
+		float A = a(1) - b(1);
+		float B = b(0) - a(0);
+		edge[k * 3][i] = A;
+		edge[k * 3 + 1][i] = B;
+		edge[k * 3 + 2][i] = -(A * a(0) + B * a(1));
+	}
+	order[i] = draw_order;
+	box[i * 4] = std::min(w[0](0), std::min(w[1](0), w[2](0)));
+	box[i * 4 + 1] = std::min(w[0](1), std::min(w[1](1), w[2](1)));
+	box[i * 4 + 2] = std::max(w[0](0), std::max(w[1](0), w[2](0)));
+	box[i * 4 + 3] = std::max(w[0](1), std::max(w[1](1), w[2](1)));
+	set_moving(i, type, is_posed);
+	if (type != 0) { // as the shader: about the world barycenter, the model one for type 7
+		Eigen::Vector2f b = (v[0] + v[1] + v[2]) / 3.0f;
+		Eigen::Vector2f p = (type == 7) ? b : world * b;
+		phase[i] = AnimationTable::phase_class(std::floor(v[0](0) * 1000));
+		pivot[i * 2] = p(0);
+		pivot[i * 2 + 1] = p(1);
+		float* bx = &box[i * 4];
+		if (type == 1 || type == 7) {
+			float r = 0.0f;
+			for (int k = 0; k < 3; k++) { r = std::max(r, (w[k] - p).norm()); }
+			bx[0] = p(0) - r; bx[1] = p(1) - r; bx[2] = p(0) + r; bx[3] = p(1) + r;
+		}
+		else if (type == 2 || type == 3) {
+			int a = type - 2; // the axis that flips
+			float r = std::max(std::abs(bx[a] - p(a)), std::abs(bx[a + 2] - p(a)));
+			bx[a] = p(a) - r;
+			bx[a + 2] = p(a) + r;
+		}
+		else if (type == 4 || type == 5) {
+			bx[type - 4] -= 1.0f;
+			bx[type - 2] += 1.0f;
+		}
+		else if (type == 6) {
+			for (int k = 0; k < 4; k++) { bx[k] = p(k & 1) + 1.5f * (bx[k] - p(k & 1)); }
+		}
+	}
+	mark_pending(i);
+}
+
+inline void TrianglePicker::clear(int i) {
+	if (i >= capacity) { return; }
+	for (int k = 0; k < 9; k++) { edge[k][i] = 0.0f; }
+	order[i] = 0;
+	set_moving(i, 0, false);
+	mark_pending(i);
+}
+
+// A change of slot i reaches the still scene unless it moves before and after.
+inline void TrianglePicker::set_moving(int i, int type, bool is_posed) {
+	bool was = moving(i), is = type != 0 || is_posed;
+	if (!was || !is) { still_changed = true; }
+	moving_count += int(is) - int(was);
+	motion[i] = (unsigned char)type;
+	posed[i] = is_posed;
+}
+
+inline void TrianglePicker::mark_pending(int i) {
+	if (!pending[i]) {
+		pending[i] = 1;
+		pending_list.push_back(i);
+	}
+}
+
+// Apply the slots changed since the last call to the tree.
+inline void TrianglePicker::update(void) {
+	if (pending_list.empty()) { return; }
+	version ++;
+	if (still_changed) { still_version ++; }
+	still_changed = false;
+	bool bulk = (int)pending_list.size() > tree.leaves / 2 + 64;
+	bool batch = (int)pending_list.size() > PICK_BATCH;
+	std::vector<int> moved; // refit below, in one batch
+	for (size_t k = 0; k < pending_list.size(); k++) {
+		int i = pending_list[k];
+		pending[i] = 0;
+		if (bulk) { // leaves only, built below
+			if (order[i] == 0) { tree.unset(i); }
+			else { tree.set(i, &box[i * 4]); }
+		}
+		else if (order[i] == 0) { tree.remove(i); }
+		else if (batch) { moved.push_back(i); }
+		else { tree.move(i, &box[i * 4]); }
+	}
+	if (bulk) { tree.build(); }
+	else if (!moved.empty()) { tree.move_many(moved, box.data()); }
+	pending_list.clear();
+}
+
+// Whether x,y is strictly inside the triangle of slot i.
+inline bool TrianglePicker::hit(int i, float x, float y) const {
+	float e0 = edge[0][i] * x + edge[1][i] * y + edge[2][i];
+	float e1 = edge[3][i] * x + edge[4][i] * y + edge[5][i];
+	float e2 = edge[6][i] * x + edge[7][i] * y + edge[8][i];
+	return (e0 > 0 && e1 > 0 && e2 > 0) || (e0 < 0 && e1 < 0 && e2 < 0); // either winding
+}
+
+// World area of the triangle of slot i, from two of its edges.
+inline float TrianglePicker::area(int i) const {
+	return 0.5f * std::abs(edge[0][i] * edge[4][i] - edge[1][i] * edge[3][i]);
+}
+
+// Move x,y back by the motion slot i is drawn with in table, to test it against the slot
+// at rest. False if the motion flattens the triangle, seen edge-on.
+inline bool TrianglePicker::unmove(int i, const AnimationTable& table, float* x, float* y) const {
+	const Affine2& m = table.motion[motion[i]][phase[i]];
+	float det = m.a * m.d - m.b * m.c;
+	if (std::abs(det) < 1e-6f) { return false; }
+	float px = *x - pivot[i * 2] - m.x, py = *y - pivot[i * 2 + 1] - m.y;
+	*x = (m.d * px - m.c * py) / det + pivot[i * 2];
+	*y = (m.a * py - m.b * px) / det + pivot[i * 2 + 1];
+	return true;
+}
+
+// Topmost triangle strictly containing x,y as drawn with the animations of table, -1 if
+// none, among the moving slots only if moving_only. The tree must be up to date (see update).
+// The candidates are gathered PICK_LANES at a time into lane arrays, each with the point
+// moved back by its motion, and tested as straight-line loops over the lanes that the
+// compiler turns into SIMD code. Each lane keeps the highest draw order it has hit, and the
+// lanes are reduced at the end.
+inline int TrianglePicker::pick(float x, float y, const AnimationTable& table, bool moving_only) const {
+	float p[4] = {x, y, x, y};
+	candidates.clear();
+	tree.query(p, candidates);
+
+	float px[PICK_LANES], py[PICK_LANES], e[9][PICK_LANES];
+	unsigned key[PICK_LANES], best[PICK_LANES];
+	int lane_slot[PICK_LANES], best_slot[PICK_LANES];
+	for (int l = 0; l < PICK_LANES; l++) {
+		best[l] = 0;
+		best_slot[l] = -1;
+	}
+	size_t k = 0;
+	while (k < candidates.size()) {
+		int lanes = 0;
+		for (; k < candidates.size() && lanes < PICK_LANES; k++) { // gather
+			int i = candidates[k];
+			if (moving_only && !moving(i)) { continue; }
+			float qx = x, qy = y;
+			if (motion[i] != 0 && !unmove(i, table, &qx, &qy)) { continue; }
+			px[lanes] = qx;
+			py[lanes] = qy;
+			for (int c = 0; c < 9; c++) { e[c][lanes] = edge[c][i]; }
+			key[lanes] = order[i];
+			lane_slot[lanes] = i;
+			lanes ++;
+		}
+		for (int l = lanes; l < PICK_LANES; l++) { // the lanes left over never hit
+			px[l] = py[l] = 0.0f;
+			for (int c = 0; c < 9; c++) { e[c][l] = 0.0f; }
+			key[l] = 0;
+			lane_slot[l] = -1;
+		}
+		for (int l = 0; l < PICK_LANES; l++) {
+			float e0 = e[0][l] * px[l] + e[1][l] * py[l] + e[2][l];
+			float e1 = e[3][l] * px[l] + e[4][l] * py[l] + e[5][l];
+			float e2 = e[6][l] * px[l] + e[7][l] * py[l] + e[8][l];
+			unsigned inside = ((e0 > 0) & (e1 > 0) & (e2 > 0)) | ((e0 < 0) & (e1 < 0) & (e2 < 0)); // either winding
+			unsigned hit = key[l] * inside;
+			bool higher = hit > best[l];
+			best[l] = higher ? hit : best[l];
+			best_slot[l] = higher ? lane_slot[l] : best_slot[l];
+		}
+	}
+	int slot = -1;
+	unsigned top = 0;
+	for (int l = 0; l < PICK_LANES; l++) {
+		if (best[l] > top) {
+			top = best[l];
+			slot = best_slot[l];
+		}
+	}
+	return slot;
+}
+
+#endif
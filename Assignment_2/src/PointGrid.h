@@ -0,0 +1,170 @@
+#ifndef POINT_GRID_H
+#define POINT_GRID_H
+
+#include <Eigen/Core>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+#define POINT_CELL 0.05f // Cell size of the nearest point grid.
+
+// Hashed uniform grid over points named by an integer id, for nearest point queries.
+// Only the occupied cells are stored, so a point costs O(1) to insert, move or remove
+// whatever the extent of the scene. Queries walk the cells in rings of growing distance
+// around the query point and stop as soon as no unvisited cell can hold a closer point.
+class PointGrid {
+	public:
+		std::vector<float> position;  // x,y of each id.
+		std::vector<long long> cell;  // Cell of each id, LLONG_MIN if the id is not in the grid.
+		std::vector<int> place;       // Index of each id in the list of its cell.
+		std::unordered_map<long long, std::vector<int> > cells; // Cell -> ids in it.
+		int count;                    // Numbers of ids in the grid.
+		int lo[2], hi[2];             // Range of the cells ever occupied, bounds the rings.
+
+	void init(void);
+	void move(int id, float x, float y);
+	void remove(int id);
+	bool contains(int id) const;
+	int nearest(float x, float y, float radius) const;
+	void within(float x, float y, float radius, std::vector<int>& out) const;
+	void k_nearest(float x, float y, int k, float radius, std::vector<int>& out) const;
+
+	private:
+	static long long key(int ix, int iy);
+	static int cell_of(float v);
+	template <typename Visit> void rings(float x, float y, float radius, Visit visit) const;
+};
+
+//Implementation
+inline long long PointGrid::key(int ix, int iy) {
+	return ((long long)ix << 32) ^ ((long long)iy & 0xffffffffLL);
+}
+
+inline int PointGrid::cell_of(float v) {
+	return (int)std::floor(v / POINT_CELL);
+}
+
+inline void PointGrid::init(void) {
+	position.clear();
+	cell.clear();
+	place.clear();
+	cells.clear();
+	count = 0;
+	lo[0] = lo[1] = INT_MAX;
+	hi[0] = hi[1] = INT_MIN;
+}
+
+inline bool PointGrid::contains(int id) const {
+	return id < (int)cell.size() && cell[id] != LLONG_MIN;
+}
+
+// Put id at x,y, inserting it if it is not in the grid yet.
+inline void PointGrid::move(int id, float x, float y) {
+	if (id >= (int)cell.size()) {
+		int n = std::max(id + 1, (int)cell.size() * 2);
+		position.resize(n * 2);
+		cell.resize(n, LLONG_MIN);
+		place.resize(n);
+	}
+	int ix = cell_of(x), iy = cell_of(y);
+	long long c = key(ix, iy);
+	position[id * 2] = x;
+	position[id * 2 + 1] = y;
+	if (cell[id] == c) { return; }
+	if (cell[id] != LLONG_MIN) { remove(id); }
+	std::vector<int>& list = cells[c];
+	cell[id] = c;
+	place[id] = (int)list.size();
+	list.push_back(id);
+	count ++;
+	lo[0] = std::min(lo[0], ix); hi[0] = std::max(hi[0], ix);
+	lo[1] = std::min(lo[1], iy); hi[1] = std::max(hi[1], iy);
+}
+
+inline void PointGrid::remove(int id) {
+	if (!contains(id)) { return; }
+	auto it = cells.find(cell[id]);
+	std::vector<int>& list = it->second;
+	int last = list.back();
+	list[place[id]] = last; // swap with the last id of the cell
+	place[last] = place[id];
+	list.pop_back();
+	if (list.empty()) { cells.erase(it); }
+	cell[id] = LLONG_MIN;
+	count --;
+}
+
+// Call visit(id, squared distance) for the ids in the rings of cells around x,y, ring by
+// ring. visit returns the squared distance beyond which nothing is wanted any more, and the
+// walk stops once the next ring is farther than that, or than radius.
+template <typename Visit>
+inline void PointGrid::rings(float x, float y, float radius, Visit visit) const {
+	if (count == 0) { return; }
+	int cx = cell_of(x), cy = cell_of(y);
+	float limit = radius * radius;
+	int last = std::max(std::max(cx - lo[0], hi[0] - cx), std::max(cy - lo[1], hi[1] - cy));
+	for (int r = 0; r <= last; r++) {
+		float gap = (r - 1) * POINT_CELL; // the closest a point of ring r can be
+		if (r > 0 && gap * gap > limit) { return; }
+		for (int ix = std::max(cx - r, lo[0]); ix <= std::min(cx + r, hi[0]); ix++) {
+			bool side = ix == cx - r || ix == cx + r; // only the border of the ring
+			for (int iy = std::max(cy - r, lo[1]); iy <= std::min(cy + r, hi[1]); iy++) {
+				if (!side && iy != cy - r && iy != cy + r) { iy = cy + r - 1; continue; }
+				auto it = cells.find(key(ix, iy));
+				if (it == cells.end()) { continue; }
+				const std::vector<int>& list = it->second;
+				for (size_t k = 0; k < list.size(); k++) {
+					int id = list[k];
+					float dx = position[id * 2] - x, dy = position[id * 2 + 1] - y;
+					float d = dx * dx + dy * dy;
+					if (d <= radius * radius) { limit = std::min(limit, visit(id, d)); }
+				}
+			}
+		}
+	}
+}
+
+// The id closest to x,y within radius, -1 if none.
+inline int PointGrid::nearest(float x, float y, float radius) const {
+	int best = -1;
+	float best_d = radius * radius;
+	rings(x, y, radius, [&](int id, float d) {
+		if (d < best_d || (d == best_d && best != -1 && id < best)) {
+			best_d = d;
+			best = id;
+		}
+		return best_d;
+	});
+	return best;
+}
+
+// Append to out the ids within radius of x,y, in no particular order.
+inline void PointGrid::within(float x, float y, float radius, std::vector<int>& out) const {
+	rings(x, y, radius, [&](int id, float) {
+		out.push_back(id);
+		return radius * radius;
+	});
+}
+
+// Append to out the k ids closest to x,y within radius, the closest first.
+inline void PointGrid::k_nearest(float x, float y, int k, float radius, std::vector<int>& out) const {
+	if (k <= 0) { return; }
+	std::vector<std::pair<float, int> > heap; // max-heap of the k best so far
+	rings(x, y, radius, [&](int id, float d) {
+		if ((int)heap.size() < k) {
+			heap.push_back(std::make_pair(d, id));
+			std::push_heap(heap.begin(), heap.end());
+		} else if (d < heap.front().first) {
+			std::pop_heap(heap.begin(), heap.end());
+			heap.back() = std::make_pair(d, id);
+			std::push_heap(heap.begin(), heap.end());
+		}
+		return (int)heap.size() < k ? radius * radius : heap.front().first;
+	});
+	std::sort_heap(heap.begin(), heap.end());
+	for (size_t j = 0; j < heap.size(); j++) { out.push_back(heap[j].second); }
+}
+
+#endif
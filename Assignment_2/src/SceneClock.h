@@ -0,0 +1,79 @@
+#ifndef SCENE_CLOCK_H
+#define SCENE_CLOCK_H
+
+#include <algorithm>
+#include <cmath>
+
+// The time the scene is drawn at. It is read once per frame, after tick, so every triangle of
+// a frame sees the same time, and it only moves by whole steps: the time is steps * step.
+// In lockstep every tick moves it rate steps, whatever the wall time, so a run sees the same
+// times frame after frame on any machine; otherwise a tick moves it by the wall time since
+// the last one, times rate, the rest carried to the next tick. It can be paused, seeked and
+// stepped by hand.
+class SceneClock {
+	public:
+		double step;        // Seconds of scene time per step.
+		double rate;        // Scene seconds per wall second, or steps per tick in lockstep.
+		bool paused;
+		bool lockstep;
+		long long steps;    // Scene time in steps.
+		long long frame;    // Ticks since init.
+		double carry;       // Steps not taken yet.
+		double last;        // Wall time of the last tick, in seconds, negative before the first.
+
+	void init(double step);
+	void tick(double now);
+	double time(void) const { return steps * step; }
+	void seek(double t);
+	void step_by(long long n);
+	void pause(bool p);
+	void hold(void);
+};
+
+//Implementation
+inline void SceneClock::init(double step) {
+	this->step = step;
+	rate = 1.0;
+	paused = false;
+	lockstep = false;
+	steps = frame = 0;
+	carry = 0.0;
+	last = -1.0;
+}
+
+// Advance to the next frame, now being the wall time in seconds.
+inline void SceneClock::tick(double now) {
+	double elapsed = last < 0 ? 0.0 : now - last;
+	last = now;
+	frame ++;
+	if (paused) { return; }
+	carry += lockstep ? rate : elapsed * rate / step;
+	long long n = (long long)std::floor(carry);
+	steps += n;
+	carry -= n;
+}
+
+// Jump to the step closest to time t, t >= 0.
+inline void SceneClock::seek(double t) {
+	steps = (long long)std::llround(std::max(0.0, t) / step);
+	carry = 0.0;
+}
+
+inline void SceneClock::step_by(long long n) {
+	steps = std::max(0LL, steps + n);
+	carry = 0.0;
+}
+
+// A paused clock drops the wall time that passes until it resumes.
+inline void SceneClock::pause(bool p) {
+	paused = p;
+	hold();
+}
+
+// The wall time until the next tick does not count, as when nothing was animated.
+inline void SceneClock::hold(void) {
+	last = -1.0;
+	carry = 0.0;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <vector>
+#include <algorithm>
+
+// Set of selected triangle slots. The slots are kept densely in items, in no particular
+// order, so the batch edits on the selection run over one contiguous array; place maps a
+// slot back to its index in items, so add, remove and contains are O(1). serial changes
+// with the content, to tell a selection apart from the one seen last.
+class Selection {
+	public:
+		std::vector<int> items; // The selected slots.
+		std::vector<int> place; // Index of each slot in items, -1 if it is not selected.
+		unsigned serial;        // Bumped by every change.
+
+	void init(void);
+	void add(int t);
+	void remove(int t);
+	void clear(void);
+	bool contains(int t) const;
+	bool empty(void) const { return items.empty(); }
+	int size(void) const { return (int)items.size(); }
+};
+
+//Implementation
+inline void Selection::init(void) {
+	items.clear();
+	place.clear();
+	serial = 0;
+}
+
+inline void Selection::add(int t) {
+	if (t >= (int)place.size()) { place.resize(std::max(t + 1, (int)place.size() * 2), -1); }
+	if (place[t] != -1) { return; }
+	place[t] = (int)items.size();
+	items.push_back(t);
+	serial ++;
+}
+
+inline void Selection::remove(int t) {
+	if (!contains(t)) { return; }
+	int last = items.back();
+	items[place[t]] = last; // swap with the last item
+	place[last] = place[t];
+	items.pop_back();
+	place[t] = -1;
+	serial ++;
+}
+
+inline void Selection::clear(void) {
+	if (items.empty()) { return; }
+	for (size_t k = 0; k < items.size(); k++) { place[items[k]] = -1; }
+	items.clear();
+	serial ++;
+}
+
+inline bool Selection::contains(int t) const {
+	return t >= 0 && t < (int)place.size() && place[t] != -1;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include "Affine2.h"
+
+#include <Eigen/Core>
+#include <vector>
+
+#define INSTANCE_FLOATS 8 // Per instance: model (a,b,c,d,x,y), color override, animation type.
+#define NO_COLOR_OVERRIDE -2.0f
+
+// Reusable shape definitions and their instances. The geometry of a shape is stored once;
+// an instance only holds a transform, a color override and an animation type, so a shape
+// with any number of instances renders with one instanced draw call.
+class ShapeLibrary {
+	public:
+		std::vector<float> position;            // x,y of the vertices of every shape, 3 vertices per triangle.
+		std::vector<float> color;               // Color code of those vertices.
+		std::vector<int> first;                 // First vertex of each shape.
+		std::vector<int> size;                  // Numbers of vertices of each shape.
+		std::vector<Eigen::Vector2f> barycenter;
+		std::vector<std::vector<float> > instances; // INSTANCE_FLOATS per instance, one array per shape.
+		std::vector<float> instance_data;       // Every instance packed shape after shape, for upload.
+		std::vector<int> first_instance;        // First instance of each shape in instance_data.
+		bool changed;                           // Shapes or instances were added since the last pack.
+
+	void init(void);
+	int count(void) const;
+	int add_shape(const std::vector<float>& xy, const std::vector<float>& c);
+	void add_instance(int shape, const Affine2& m, float color_override, float animation);
+	int instance_count(int shape) const;
+	void pack(void);
+};
+
+//Implementation
+inline void ShapeLibrary::init(void) {
+	position.clear();
+	color.clear();
+	first.clear();
+	size.clear();
+	barycenter.clear();
+	instances.clear();
+	instance_data.clear();
+	first_instance.clear();
+	changed = true;
+}
+
+inline int ShapeLibrary::count(void) const {
+	return (int)first.size();
+}
+
+// Add a shape made of the triangles whose vertices are xy (x,y per vertex) with color codes c.
+inline int ShapeLibrary::add_shape(const std::vector<float>& xy, const std::vector<float>& c) {
+	int n = (int)c.size();
+	first.push_back((int)color.size());
+	size.push_back(n);
+	position.insert(position.end(), xy.begin(), xy.end());
+	color.insert(color.end(), c.begin(), c.end());
+	Eigen::Vector2f b(0, 0);
+	for (int k = 0; k < n; k++) { b += Eigen::Vector2f(xy[k * 2], xy[k * 2 + 1]); }
+	barycenter.push_back(b / std::max(n, 1));
+	instances.push_back(std::vector<float>());
+	first_instance.push_back(0);
+	changed = true;
+	return count() - 1;
+}
+
+inline void ShapeLibrary::add_instance(int shape, const Affine2& m, float color_override, float animation) {
+	std::vector<float>& data = instances[shape];
+	data.insert(data.end(), m.data(), m.data() + 6);
+	data.push_back(color_override);
+	data.push_back(animation);
+	changed = true;
+}
+
+inline int ShapeLibrary::instance_count(int shape) const {
+	return (int)instances[shape].size() / INSTANCE_FLOATS;
+}
+
+// Concatenate the instances of all the shapes into instance_data.
+inline void ShapeLibrary::pack(void) {
+	instance_data.clear();
+	for (int s = 0; s < count(); s++) {
+		first_instance[s] = (int)instance_data.size() / INSTANCE_FLOATS;
+		instance_data.insert(instance_data.end(), instances[s].begin(), instances[s].end());
+	}
+	changed = false;
+}
+
+#endif
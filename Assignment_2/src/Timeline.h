@@ -0,0 +1,210 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#define TRACK_POSITION 0 // Translation tx,ty of the target.
+#define TRACK_ROTATION 1 // Rotation angle in radians.
+#define TRACK_SCALE 2    // Uniform scale factor.
+#define TRACK_COLOR 3    // r,g,b in [0,1].
+#define TRACK_CHANNELS 4
+#define TRACK_VALUES 3   // Floats per key, the ones a channel does not use are 0.
+#define TRACK_LINEAR 0
+#define TRACK_CUBIC 1    // Catmull-Rom through the keys.
+#define TIMELINE_CHUNK 4096 // Tracks evaluated by one thread at least.
+
+// Keyframe tracks of the scene. A track animates one channel of one target, a triangle slot
+// or a group, and is removed with its target. The keys of all the tracks live in flat arrays,
+// a track owning a range of them sorted by time; before its first key and after its last a
+// track holds the value of that key.
+//
+// evaluate computes every track at one time in one pass, in two steps: a scalar step finds
+// the keys around the time (starting from the segment of the last call, since the time
+// mostly moves forward) and gathers the four keys and weights of the interpolation, then a
+// straight loop blends them, which the compiler vectorizes. A big timeline is split in
+// chunks evaluated by several threads.
+class Timeline {
+	public:
+		std::vector<int> target;        // Triangle slot or group of each track.
+		std::vector<char> group;        // The target is a group.
+		std::vector<char> channel;      // TRACK_POSITION...TRACK_COLOR.
+		std::vector<char> interpolation;
+		std::vector<int> first, count;  // Keys of each track.
+		std::vector<int> cursor;        // Segment of the last evaluation, per track.
+		std::vector<float> key_time;
+		std::vector<float> key_value;   // TRACK_VALUES per key.
+		std::vector<float> value;       // TRACK_VALUES per track, computed by evaluate.
+		int threads;
+
+	void init(void);
+	bool empty(void) const { return target.empty(); }
+	int size(void) const { return (int)target.size(); }
+	int find(int t, bool is_group, int c) const;
+	int track(int t, bool is_group, int c);
+	void set_key(int k, float time, const float* v);
+	float end(int k) const;
+	float duration(void) const;
+	void set_interpolation(int t, bool is_group, int mode);
+	void remove_target(int t, bool is_group);
+	void evaluate(float time);
+
+	private:
+		std::vector<float> gathered[4]; // Keys around the time, TRACK_VALUES per track.
+		std::vector<float> weight[4];   // Their weights, repeated for the TRACK_VALUES of a track.
+	void evaluate_range(float time, int begin, int end);
+};
+
+//Implementation
+inline void Timeline::init(void) {
+	target.clear();
+	group.clear();
+	channel.clear();
+	interpolation.clear();
+	first.clear();
+	count.clear();
+	cursor.clear();
+	key_time.clear();
+	key_value.clear();
+	value.clear();
+	threads = std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// Track of channel c of a target, -1 if it has none.
+inline int Timeline::find(int t, bool is_group, int c) const {
+	for (int k = 0; k < size(); k++) {
+		if (target[k] == t && group[k] == is_group && channel[k] == c) { return k; }
+	}
+	return -1;
+}
+
+// Track of channel c of a target, made empty if it has none.
+inline int Timeline::track(int t, bool is_group, int c) {
+	int k = find(t, is_group, c);
+	if (k != -1) { return k; }
+	target.push_back(t);
+	group.push_back(is_group);
+	channel.push_back(c);
+	interpolation.push_back(TRACK_LINEAR);
+	first.push_back((int)key_time.size());
+	count.push_back(0);
+	cursor.push_back(0);
+	value.resize(value.size() + TRACK_VALUES, 0.0f);
+	return size() - 1;
+}
+
+// Set the value of track k at time, replacing the key at that time if there is one. The keys
+// after it move up, edits are rare next to evaluations.
+inline void Timeline::set_key(int k, float time, const float* v) {
+	std::vector<float>::iterator begin = key_time.begin() + first[k], end = begin + count[k];
+	std::vector<float>::iterator at = std::lower_bound(begin, end, time);
+	int i = (int)(at - key_time.begin());
+	if (at == end || *at != time) {
+		key_time.insert(at, time);
+		key_value.insert(key_value.begin() + i * TRACK_VALUES, TRACK_VALUES, 0.0f);
+		count[k] ++;
+		for (int j = 0; j < size(); j++) {
+			if (j != k && first[j] >= i) { first[j] ++; }
+		}
+	}
+	std::copy(v, v + TRACK_VALUES, &key_value[i * TRACK_VALUES]);
+}
+
+// Time of the last key of track k, -1 if it has none.
+inline float Timeline::end(int k) const {
+	return count[k] == 0 ? -1.0f : key_time[first[k] + count[k] - 1];
+}
+
+// Time of the last key of all.
+inline float Timeline::duration(void) const {
+	float d = 0.0f;
+	for (int k = 0; k < size(); k++) { d = std::max(d, end(k)); }
+	return d;
+}
+
+inline void Timeline::set_interpolation(int t, bool is_group, int mode) {
+	for (int k = 0; k < size(); k++) {
+		if (target[k] == t && group[k] == is_group) { interpolation[k] = mode; }
+	}
+}
+
+// Drop the tracks of a target and their keys.
+inline void Timeline::remove_target(int t, bool is_group) {
+	for (int k = size() - 1; k >= 0; k--) {
+		if (target[k] != t || group[k] != is_group) { continue; }
+		int i = first[k], n = count[k];
+		key_time.erase(key_time.begin() + i, key_time.begin() + i + n);
+		key_value.erase(key_value.begin() + i * TRACK_VALUES, key_value.begin() + (i + n) * TRACK_VALUES);
+		for (int j = 0; j < size(); j++) {
+			if (first[j] > i) { first[j] -= n; }
+		}
+		target.erase(target.begin() + k);
+		group.erase(group.begin() + k);
+		channel.erase(channel.begin() + k);
+		interpolation.erase(interpolation.begin() + k);
+		first.erase(first.begin() + k);
+		count.erase(count.begin() + k);
+		cursor.erase(cursor.begin() + k);
+		value.erase(value.begin() + k * TRACK_VALUES, value.begin() + (k + 1) * TRACK_VALUES);
+	}
+}
+
+// Every track at time, into value.
+inline void Timeline::evaluate(float time) {
+	int n = size();
+	if (n == 0) { return; }
+	for (int k = 0; k < 4; k++) {
+		gathered[k].resize((size_t)n * TRACK_VALUES);
+		weight[k].resize((size_t)n * TRACK_VALUES);
+	}
+	int chunks = std::max(1, std::min(threads, n / TIMELINE_CHUNK));
+	std::vector<std::thread> workers;
+	for (int c = 1; c < chunks; c++) {
+		workers.push_back(std::thread(&Timeline::evaluate_range, this, time, n * c / chunks, n * (c + 1) / chunks));
+	}
+	evaluate_range(time, 0, n / chunks);
+	for (size_t k = 0; k < workers.size(); k++) { workers[k].join(); }
+}
+
+inline void Timeline::evaluate_range(float time, int begin, int end) {
+	for (int k = begin; k < end; k++) { // find the segment and gather its keys
+		int n = count[k];
+		const float* times = n == 0 ? NULL : &key_time[first[k]];
+		int i = 0;    // key before time
+		float u = 0;  // position of time between key i and i + 1
+		if (n > 1 && time > times[0]) {
+			i = std::min(cursor[k], n - 2);
+			if (time < times[i] || time >= times[i + 1]) {
+				if (i + 2 < n && time >= times[i + 1] && time < times[i + 2]) { i ++; }
+				else { i = std::max(0, std::min(n - 2, (int)(std::upper_bound(times, times + n, time) - times) - 1)); }
+			}
+			cursor[k] = i;
+			u = std::min(1.0f, (time - times[i]) / (times[i + 1] - times[i]));
+		}
+		int keys[4] = {std::max(i - 1, 0), i, std::min(i + 1, n - 1), std::min(i + 2, n - 1)};
+		for (int j = 0; j < 4; j++) {
+			const float* v = n == 0 ? &value[k * TRACK_VALUES] : &key_value[(first[k] + keys[j]) * TRACK_VALUES];
+			std::copy(v, v + TRACK_VALUES, &gathered[j][k * TRACK_VALUES]);
+		}
+		float w[4] = {0, 1 - u, u, 0};
+		if (interpolation[k] == TRACK_CUBIC) {
+			float u2 = u * u, u3 = u2 * u;
+			w[0] = 0.5f * (-u3 + 2 * u2 - u);
+			w[1] = 0.5f * (3 * u3 - 5 * u2 + 2);
+			w[2] = 0.5f * (-3 * u3 + 4 * u2 + u);
+			w[3] = 0.5f * (u3 - u2);
+		}
+		for (int j = 0; j < 4; j++) { std::fill_n(&weight[j][k * TRACK_VALUES], TRACK_VALUES, w[j]); }
+	}
+	const float* w0 = &weight[0][0]; const float* w1 = &weight[1][0];
+	const float* w2 = &weight[2][0]; const float* w3 = &weight[3][0];
+	const float* g0 = &gathered[0][0]; const float* g1 = &gathered[1][0];
+	const float* g2 = &gathered[2][0]; const float* g3 = &gathered[3][0];
+	float* out = &value[0];
+	for (int i = begin * TRACK_VALUES; i < end * TRACK_VALUES; i++) { // blend
+		out[i] = w0[i] * g0[i] + w1[i] * g1[i] + w2[i] * g2[i] + w3[i] * g3[i];
+	}
+}
+
+#endif
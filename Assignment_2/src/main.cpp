@@ -2,6 +2,11 @@
 
 // OpenGL Helpers to reduce the clutter
 #include "Helpers.h"
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 using namespace std;
 using namespace Eigen;
@@ -9,17 +14,546 @@ using Clock = std::chrono::high_resolution_clock;
 using TimePoint = std::chrono::time_point<Clock>;
 
 #include "Editor.h"
+#include "InputQueue.h"
+#include "Handoff.h"
+#include "Culling.h"
+#include "Animation.h"
+#include "SceneClock.h"
 
-// Global Variables
-VertexBufferObject VBO; // VertexBufferObject wrapper
+#define SLOT_FLOATS 16 // Per triangle slot of the batched path, see vertex_shader_batched.glsl.
+#define GROUP_FLOATS 8 // Per group: its world transform a,b,c,d,x,y and 2 unused, see vertex_shader_batched.glsl.
+#define SLOT_FREE 0    // Layer a triangle slot is drawn in: none,
+#define SLOT_STATIC 1  // the cached static layer,
+#define SLOT_DYNAMIC 2 // or every frame over it.
+
+// Two threads share the work. The main thread handles the input and owns the Editor; after
+// every batch of input it publishes what the frame needs, a FrameSnapshot, and the changes
+// of the geometry, as SceneEdits. The render thread owns the GL context: it applies the
+// edits to the GPU buffers and draws the latest snapshot, so a slow edit never stalls the
+// drawing and the input never waits for the GPU. Neither side takes a lock to hand over.
+
+// Global Variables of the render thread
+PagedBuffer positions;          // positions of the unique vertices, PAGE_VERTICES per page
+PagedBuffer colors;             // color codes of the unique vertices
+PagedBuffer indices;            // three vertex indices per triangle slot, PAGE_TRIANGLES per page
+VertexBufferObject VBO_preview; // preview of the triangle or bezier curve being edited
+VertexBufferObject VBO_shape;       // geometry of the stamped shapes, stored once
+VertexBufferObject VBO_shape_color;
+VertexBufferObject VBO_instance;    // per-instance model, color override and animation type
+UniformBufferObject UBO_frame;      // the Frame block of the vertex shader
+PagedBuffer batch_data;             // per-triangle data of the batched path, by slot
+TextureBufferObject TBO_batch, TBO_indices, TBO_positions, TBO_colors; // what vertex_shader_batched.glsl fetches
+std::vector<float> batch_copy;      // what batch_data holds, for the per-triangle fallback
+VertexBufferObject VBO_groups;      // world transform of every group, GROUP_FLOATS each
+std::vector<float> group_table;     // and what it holds
+TextureBufferObject TBO_groups;
+VertexBufferObject VBO_listed;      // slots of the visible static triangles, ascending
+VertexBufferObject VBO_dynamic;     // slots of the dynamic triangles, ascending
+std::vector<float> static_list, dynamic_list; // and what they hold, to split them in pages
+TextureBufferObject TBO_listed;
+VertexBufferObject VBO_cluster_position; // the clusters of small triangles, two triangles each, see publish_clusters
+VertexBufferObject VBO_cluster_color;
+FrameBufferObject FBO_static;       // the static triangles, color and depth, drawn again only when they change
+bool static_valid = false;          // FBO_static holds static_serial at static_view, else it must be drawn again
+unsigned static_drawn = 0;
+Eigen::Matrix4f static_view;
+int window_samples = 0;             // Samples of the window framebuffer, FBO_static has as many
+
+// Global Variables of the main thread
 Editor e;
+InputQueue input;            // Input received since the last frame, applied once per frame
+ViewCuller culler;           // The triangles in view, small ones merged when zoomed out
+bool redraw = true;          // The window content is out of date, publish a new snapshot
+bool batched = true;         // draw the scene with one call per page, T toggles the per-triangle fallback
+double idle_time = 0, busy_time = 0; // Seconds spent waiting for events, and handling them
+SceneClock scene_clock;      // The time the frames are drawn at, ticked once per animated frame
+bool animating = false;      // The picture changes with time alone, the clock ticks
+double next_tick = 0;        // Wall time of the next tick, in glfwGetTime seconds
+std::vector<float> slot_data;        // SLOT_FLOATS per triangle slot as last sent to the render thread, see pack_slot
+std::vector<char> slot_layer;        // SLOT_FREE, SLOT_STATIC or SLOT_DYNAMIC, as last sent
+std::vector<float> group_data;       // GROUP_FLOATS per group as last sent
+Selection dynamic_slots;             // The slots of SLOT_DYNAMIC
+std::vector<unsigned char> lit;      // 1 if the slot is highlighted, plus 2 if clicked
+std::vector<int> highlighted;        // The slots lit
+unsigned static_serial = 0;          // Changes with the static layer
+unsigned frame_serial = 1;           // Serial of the next snapshot, the edits pushed meanwhile go with it
+
+// Shared by the two threads
+std::atomic<bool> quit(false);
+std::atomic<bool> report_lookups(false); // Print the uniform lookup counts of the program on the next frame
+std::atomic<size_t> upload_frame(0), upload_peak(0); // Bytes sent to the buffer objects in the last frame, and the most in one
+std::atomic<long long> frames(0), render_time(0);   // Frames drawn, and the microseconds spent on them
+std::atomic<long long> static_frames(0);            // Frames that had to draw the static layer again
+std::mutex wake_mutex;               // Only to put the idle render thread to sleep
+std::condition_variable wake;
+bool wake_pending = false;
+
+// Layout of the std140 Frame block of the shaders, see shader_prelude.
+struct FrameBlock {
+	float view[16];
+	float time;
+	int animated;
+	float padding[2];
+	float pulse[ANIMATION_PHASES];
+	float motion[ANIMATION_TYPES * ANIMATION_PHASES][8]; // a,b,c,d then x,y and 2 floats of padding
+
+	void set_animation(const AnimationTable& table) {
+		for (int k = 0; k < ANIMATION_TYPES; k++) {
+			for (int q = 0; q < ANIMATION_PHASES; q++) {
+				const Affine2& m = table.motion[k][q];
+				float* out = motion[k * ANIMATION_PHASES + q];
+				out[0] = m.a; out[1] = m.b; out[2] = m.c; out[3] = m.d;
+				out[4] = m.x; out[5] = m.y; out[6] = out[7] = 0.0f;
+			}
+		}
+		std::copy(table.pulse, table.pulse + ANIMATION_PHASES, pulse);
+	}
+};
+
+// Locations of the per-draw uniforms, resolved once per frame from the reflected table of
+// the program, so the draw loops make no lookup at all.
+struct DrawUniforms {
+	GLint model, group, barycenter, phase, animation, click, is_ith_triangle, instanced, tint;
+
+	void resolve(const Program& program) {
+		model = program.uniform("model");
+		group = program.uniform("group");
+		barycenter = program.uniform("barycenter");
+		phase = program.uniform("phase");
+		animation = program.uniform("animation");
+		click = program.uniform("click");
+		is_ith_triangle = program.uniform("is_ith_triangle");
+		instanced = program.uniform("instanced");
+		tint = program.uniform("tint");
+	}
+};
+
+#define EDIT_POSITIONS 0     // Elements are vertex slots.
+#define EDIT_COLORS 1
+#define EDIT_INDICES 2       // Elements are corners, 3 per triangle slot.
+#define EDIT_SHAPE_POSITIONS 3 // Replace the whole shape buffers.
+#define EDIT_SHAPE_COLORS 4
+#define EDIT_INSTANCES 5
+#define EDIT_CLUSTER_POSITIONS 6 // Replace the whole cluster buffers.
+#define EDIT_CLUSTER_COLORS 7
+#define EDIT_SLOTS 8         // Elements are triangle slots, SLOT_FLOATS each, see pack_slot.
+#define EDIT_STATIC_LIST 9   // Replace the list of the static slots to draw.
+#define EDIT_DYNAMIC_LIST 10 // Replace the list of the dynamic slots.
+#define EDIT_GROUPS 11       // Elements are groups, GROUP_FLOATS each.
+#define EDIT_RELEASE 12      // Page first of the triangle store holds nothing, free its buffers.
+
+// Elements [first, first + bytes / element size) of a GPU buffer were changed to bytes, and
+// the buffer now has count elements, for the snapshot of that serial on.
+struct SceneEdit {
+	int target;
+	int first;
+	int count;
+	unsigned serial;
+	std::vector<char> bytes;
+};
+
+// Everything the render thread draws a frame from, copied from the Editor.
+struct FrameSnapshot {
+	int framebuffer_width, framebuffer_height;
+	int mode, insert_step, bezier_step, select_step;
+	bool batched;
+	double time;               // Scene time of the frame, from scene_clock.
+	long long frame;           // Tick of scene_clock the frame was published at.
+	unsigned serial;           // Counts the snapshots published, the edits up to it are drawn with it.
+	Eigen::Matrix4f view;
+	Eigen::Vector2f selection_drag; // World offset of the slots flagged as dragged, see Editor::translate_selection.
+	std::vector<float> preview; // x,y per column, the bezier curve sampled in columns 4 and up.
+	int preview_cols;
+	std::vector<int> draw_order;  // Slots to draw, bottom to top, for the per-triangle fallback only.
+	unsigned static_serial;       // Changes when the static triangles do, see publish_frame.
+	std::vector<int> shape_first, shape_size, shape_first_instance, shape_instances;
+	std::vector<float> shape_barycenter, shape_phase;
+
+	FrameSnapshot() : framebuffer_width(0), framebuffer_height(0), mode(0), time(0), frame(0), serial(0), preview_cols(0), static_serial(0) {}
+};
+
+// What the highlighted triangles follow from, to find them again only when it changes.
+struct Highlight {
+	int hover, triangle, group;
+	bool clicked;
+	unsigned selection;  // Selection::serial
+	int count;           // The inserts and deletes since may have reused a slot.
+	unsigned next_order;
+
+	bool operator==(const Highlight& h) const {
+		return hover == h.hover && triangle == h.triangle && group == h.group && clicked == h.clicked
+			&& selection == h.selection && count == h.count && next_order == h.next_order;
+	}
+};
+Highlight shown_highlight = {-1, -1, 0, false, 0, -1, 0};
+
+SnapshotBuffer<FrameSnapshot> snapshots;
+HandoffQueue<SceneEdit> edits;
+
+// Main thread
+
+void push_edit(int target, int first, int last, const void* data, int size, int count) {
+	SceneEdit edit;
+	edit.target = target;
+	edit.first = first;
+	edit.count = count;
+	edit.serial = frame_serial;
+	const char* bytes = (const char*)data + (size_t)size * first;
+	edit.bytes.assign(bytes, bytes + (size_t)size * (last - first));
+	edits.push(std::move(edit));
+}
+
+// Turn a list of elements into sorted ranges first,last, merging those less than gap apart.
+std::vector<std::pair<int, int> > to_ranges(std::vector<int>& items, int gap) {
+	std::vector<std::pair<int, int> > ranges;
+	std::sort(items.begin(), items.end());
+	for (size_t k = 0; k < items.size(); k++) {
+		if (!ranges.empty() && items[k] <= ranges.back().second + gap) { ranges.back().second = std::max(ranges.back().second, items[k] + 1); }
+		else { ranges.push_back(std::make_pair(items[k], items[k] + 1)); }
+	}
+	return ranges;
+}
+
+// Send the vertices and corners the triangle store journaled since the last call, and the
+// shapes when some were added. Returns whether the triangles changed.
+bool push_scene_edits() {
+	TriangleStore& t = e.triangles;
+	std::vector<std::pair<int, int> > ranges = to_ranges(t.vertex_edits, 64);
+	for (size_t k = 0; k < ranges.size(); k++) {
+		push_edit(EDIT_POSITIONS, ranges[k].first, ranges[k].second, t.position.data(), sizeof(float) * 2, t.vertex_slots);
+		push_edit(EDIT_COLORS, ranges[k].first, ranges[k].second, t.color.data(), sizeof(float), t.vertex_slots);
+	}
+	ranges = to_ranges(t.index_edits, 64);
+	for (size_t k = 0; k < ranges.size(); k++) {
+		push_edit(EDIT_INDICES, ranges[k].first * 3, ranges[k].second * 3, t.index.data(), sizeof(unsigned int), t.slots * 3);
+	}
+	bool changed = !t.vertex_edits.empty() || !t.index_edits.empty();
+	t.vertex_edits.clear();
+	t.index_edits.clear();
+	if (e.shapes.changed) {
+		e.shapes.pack();
+		int n = (int)e.shapes.color.size(), m = (int)e.shapes.instance_data.size() / INSTANCE_FLOATS;
+		push_edit(EDIT_SHAPE_POSITIONS, 0, n, e.shapes.position.data(), sizeof(float) * 2, n);
+		push_edit(EDIT_SHAPE_COLORS, 0, n, e.shapes.color.data(), sizeof(float), n);
+		push_edit(EDIT_INSTANCES, 0, m, e.shapes.instance_data.data(), sizeof(float) * INSTANCE_FLOATS, m);
+	}
+	return changed;
+}
+
+// Write in out the SLOT_FLOATS floats vertex_shader_batched.glsl draws triangle slot t from,
+// all zeros for a free slot, and return its layer. The slot holds the model and the group,
+// whose world transform the shader reads from the group table, so moving a group sends
+// nothing but its row; and a flag for the selection being dragged, shifted by the offset of
+// the frame, so a drag sends nothing at all. The draw order goes in the depth, the top
+// triangle the closest, so the pages can be drawn one after the other. The triangles that
+// change with time alone, the highlighted and the animated ones, are dynamic: the render
+// thread draws them every frame over a cached layer of the others. So are the ones the
+// timeline moves, posed here, in the root group.
+int pack_slot(int t, float* out) {
+	std::fill(out, out + SLOT_FLOATS, 0.0f);
+	if (!e.triangles.alive[t]) { return SLOT_FREE; }
+	bool keyed = e.keyed(t);
+	int group = keyed ? 0 : e.triangles.group[t];
+	Affine2 model = keyed ? e.posed_world(t) : e.triangles.model[t];
+	Vector2f barycenter = e.triangles.barycenter(t);
+	out[0] = model.a; out[1] = model.b; out[2] = model.c; out[3] = model.d;
+	out[4] = model.x; out[5] = model.y; out[6] = barycenter(0); out[7] = barycenter(1);
+	out[8] = floor(e.triangles.vertex(t, 0)(0)*1000);
+	out[9] = e.triangles.animation[t];
+	const float* tint = e.tint(t);
+	if (tint) {
+		out[12] = tint[0]; out[13] = tint[1]; out[14] = tint[2]; out[15] = 1.0f;
+	}
+	int highlight = lit[t] & 1, click = (lit[t] >> 1) & 1;
+	bool animated = keyed || (e.mode == ANIMATION_MODE && e.triangles.animation[t] != 0);
+	int is_dynamic = highlight || animated;
+	int dragged = e.selection_drag != Vector2f(0, 0) && e.selection.contains(t);
+	out[10] = float(highlight + 2 * click + 4 * is_dynamic + 8 * dragged + 16 * group);
+	out[11] = 1.0f - 2.0f * e.triangles.order[t] / DRAW_ORDER_SPAN;
+	return is_dynamic ? SLOT_DYNAMIC : SLOT_STATIC;
+}
+
+// Light the hovered, clicked and selected triangles, and the whole group of the clicked
+// one, when one of them changed since the last call. The slots lit before and after are
+// journaled for pack_slot.
+void find_highlighted(void) {
+	Highlight h = {e.hover_triangle, e.ith_triangle, e.ith_group, e.triangle_clicked, e.selection.serial, e.triangles.count, e.triangles.next_order};
+	TriangleStore& tri = e.triangles;
+	lit.resize(tri.capacity, 0);
+	if (h == shown_highlight) { return; }
+	shown_highlight = h;
+	for (size_t k = 0; k < highlighted.size(); k++) {
+		lit[highlighted[k]] = 0;
+		tri.mark_redrawn(highlighted[k]);
+	}
+	highlighted.clear();
+	int click = (e.ith_triangle != -1 && e.triangle_clicked) ? 2 : 0;
+	std::vector<int> lights; // slot, bits
+	if (e.ith_group != 0) {
+		std::vector<int> stack(1, e.ith_group);
+		while (!stack.empty()) {
+			int g = stack.back();
+			stack.pop_back();
+			for (int t = e.groups.first_member[g]; t != -1; t = e.groups.member_next[t]) { lights.push_back(t); lights.push_back(1 | click); }
+			stack.insert(stack.end(), e.groups.children[g].begin(), e.groups.children[g].end());
+		}
+	}
+	if (e.ith_triangle != -1) { lights.push_back(e.ith_triangle); lights.push_back(1 | click); }
+	if (e.hover_triangle != -1) { lights.push_back(e.hover_triangle); lights.push_back(1); }
+	for (size_t k = 0; k < e.selection.items.size(); k++) { lights.push_back(e.selection.items[k]); lights.push_back(1); }
+	for (size_t k = 0; k < lights.size(); k += 2) {
+		int t = lights[k];
+		if (t >= tri.slots || !tri.alive[t]) { continue; }
+		if (!lit[t]) { highlighted.push_back(t); }
+		lit[t] |= lights[k + 1];
+		tri.mark_redrawn(t);
+	}
+}
+
+// Send the clusters of the small triangles the culler found, see ViewCuller. A cluster is
+// drawn as a square in its pixel with the color of its triangles, each weighted by its area,
+// and as much of the pixel as they cover altogether: the multisampling blends it with what is
+// under it. It is at the depth of its top triangle, depth[t] being that of slot t.
+void publish_clusters(const float* depth, int stride) {
+	int n = (int)culler.cluster_cell.size();
+	std::vector<float> position, color;
+	position.reserve(n * 18);
+	color.reserve(n * 18);
+	float pixel_w = (culler.rect[2] - culler.rect[0]) / std::max(culler.width, 1);
+	float pixel_h = (culler.rect[3] - culler.rect[1]) / std::max(culler.height, 1);
+	for (int k = 0; k < n; k++) {
+		float area = 0, z = 1, x = 0, y = 0, rgb[3] = {0, 0, 0};
+		for (int j = culler.cluster_first[k]; j < culler.cluster_first[k + 1]; j++) {
+			int t = culler.cluster_slots[j];
+			float a = e.picker.area(t);
+			const float* b = &e.picker.box[t * 4];
+			const float* tint = e.tint(t);
+			for (int c = 0; c < 3; c++) {
+				float corner[3];
+				if (tint) { std::copy(tint, tint + 3, corner); }
+				else { e.color_to_rgb(e.triangles.corner_color(t, c), corner); }
+				for (int i = 0; i < 3; i++) { rgb[i] += a * corner[i] / 3; }
+			}
+			x += a * (b[0] + b[2]) * 0.5f;
+			y += a * (b[1] + b[3]) * 0.5f;
+			area += a;
+			z = std::min(z, depth[t * stride]);
+		}
+		if (area <= 0) { continue; }
+		float side = std::sqrt(std::min(1.0f, area / (pixel_w * pixel_h))) * 0.5f; // half of it, in pixels
+		x /= area;
+		y /= area;
+		static const int corners[6][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, -1}, {1, 1}, {-1, 1}};
+		for (int c = 0; c < 6; c++) {
+			position.push_back(x + corners[c][0] * side * pixel_w);
+			position.push_back(y + corners[c][1] * side * pixel_h);
+			position.push_back(z);
+			for (int i = 0; i < 3; i++) { color.push_back(rgb[i] / area); }
+		}
+	}
+	int m = (int)position.size() / 3;
+	push_edit(EDIT_CLUSTER_POSITIONS, 0, m, position.data(), sizeof(float) * 3, m);
+	push_edit(EDIT_CLUSTER_COLORS, 0, m, color.data(), sizeof(float) * 3, m);
+}
 
-// Callback Functions
+// Bring the editor up to date, send its edits and publish the next frame to the render thread.
+void publish_frame(GLFWwindow* window) {
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	e.aspect_ratio = float(height)/float(width);
+	e.width = float(width);
+	e.height = float(height);
+	if (e.view(0,0)/e.view(1,1) != e.aspect_ratio) { e.view(0,0) = e.aspect_ratio * e.view(1,1); }
+	if (e.mode == ANIMATION_MODE && !e.timeline.empty()) { // play the keyframes in a loop
+		if (!e.posing) { scene_clock.seek(0); }
+		float duration = e.timeline.duration();
+		e.pose(duration > 0 ? float(fmod(scene_clock.time(), duration)) : 0.0f);
+	} else { e.unpose(); }
+	e.show(float(scene_clock.time())); // what the frame draws, for the picking
+	// Recompose the model matrices and the group transforms changed since the last frame. The
+	// caches of the picking follow too, but not during a drag: what is dragged is highlighted,
+	// so drawn over the static layer whatever the culling says, and it is brought up to date
+	// once, at the next pick or when the drag ends.
+	bool dragging = e.mode == TRANSLATION_MODE && e.triangle_clicked && e.ith_triangle != -1;
+	if (dragging) { e.compose(); }
+	else { e.sync(); }
+	bool culled = culler.update(e.picker, e.view, width, height);
+	bool geometry = push_scene_edits();
+	// The clock ticks only in the animation mode, where the built-in animations and the
+	// timeline play. Elsewhere a highlight is steady: the input that changes it publishes
+	// the one frame it needs.
+	bool moving = e.mode == ANIMATION_MODE && !scene_clock.paused;
+	if (moving && !animating) { scene_clock.hold(); } // the idle time does not count
+	animating = moving;
+	if (e.mode == BEZIER_CURVE_MODE && e.bezier_step >= 4) { // sample the curve after the 4 control points
+		Vector2f v1 = e.preview.col(0);
+		Vector2f v2 = e.preview.col(1);
+		Vector2f v3 = e.preview.col(2);
+		Vector2f v4 = e.preview.col(3);
+		for (int j=0; j < 100; j ++) {
+			float t = float(j)/100;
+			float bezier_x = e.bezier_curve(v1(0), v2(0), v3(0), v4(0), t);
+			float bezier_y = e.bezier_curve(v1(1), v2(1), v3(1), v4(1), t);
+
+			e.preview.col(4 + j) << bezier_x, bezier_y;
+		}
+	}
+
+	FrameSnapshot& s = snapshots.write_buffer();
+	glfwGetFramebufferSize(window, &s.framebuffer_width, &s.framebuffer_height);
+	s.mode = e.mode;
+	s.insert_step = e.insert_step;
+	s.bezier_step = e.bezier_step;
+	s.select_step = e.select_step;
+	s.batched = batched;
+	s.time = scene_clock.time();
+	s.frame = scene_clock.frame;
+	s.serial = frame_serial;
+	s.view = e.view;
+	s.selection_drag = e.selection_drag;
+	s.preview.assign(e.preview.data(), e.preview.data() + e.preview.size());
+	s.preview_cols = e.preview.cols();
+
+	// Only the slots whose data changed are sent, and the lists of slots to draw when a
+	// slot comes or goes, changes layer, or the culling changes: a still frame costs nothing
+	// and an edit costs what it touched. A free slot is all zeros, and never listed.
+	find_highlighted();
+	TriangleStore& tri = e.triangles;
+	if (e.posing) { // the timeline moves them
+		for (size_t k = 0; k < e.keyed_list.size(); k++) { tri.mark_redrawn(e.keyed_list[k]); }
+	}
+	slot_data.resize(tri.slots * SLOT_FLOATS, 0.0f);
+	slot_layer.resize(tri.slots, SLOT_FREE);
+	bool static_changed = culled || geometry;
+	bool static_listed = culled, dynamic_listed = false;
+	std::vector<int> changed;
+	for (size_t k = 0; k < tri.redrawn_list.size(); k++) {
+		int t = tri.redrawn_list[k];
+		tri.redrawn[t] = 0;
+		float packed[SLOT_FLOATS];
+		int layer = pack_slot(t, packed);
+		float* sent = &slot_data[t * SLOT_FLOATS];
+		if (std::equal(packed, packed + SLOT_FLOATS, sent)) { continue; }
+		std::copy(packed, packed + SLOT_FLOATS, sent);
+		changed.push_back(t);
+		int last = slot_layer[t];
+		static_changed = static_changed || layer == SLOT_STATIC || last == SLOT_STATIC;
+		if (layer == last) { continue; }
+		slot_layer[t] = layer;
+		static_listed = static_listed || layer == SLOT_STATIC || last == SLOT_STATIC;
+		dynamic_listed = true;
+		if (last == SLOT_DYNAMIC) { dynamic_slots.remove(t); }
+		if (layer == SLOT_DYNAMIC) { dynamic_slots.add(t); }
+	}
+	tri.redrawn_list.clear();
+	std::vector<std::pair<int, int> > ranges = to_ranges(changed, 16);
+	for (size_t k = 0; k < ranges.size(); k++) {
+		push_edit(EDIT_SLOTS, ranges[k].first, ranges[k].second, slot_data.data(), sizeof(float) * SLOT_FLOATS, tri.slots);
+	}
+	// The pages left without a triangle are freed after the edits clearing their slots.
+	for (size_t k = 0; k < tri.emptied.size(); k++) {
+		if (tri.page_count[tri.emptied[k]] == 0) { push_edit(EDIT_RELEASE, tri.emptied[k], tri.emptied[k], NULL, 0, 0); }
+	}
+	tri.emptied.clear();
+	// The rows of the groups that moved, and of the groups under them. The static layer is
+	// drawn again unless they are all in the highlighted group, whose triangles are dynamic.
+	GroupTree& groups = e.groups;
+	group_data.resize(groups.count * GROUP_FLOATS, 0.0f);
+	std::vector<int> moved_groups, stack;
+	for (size_t k = 0; k < groups.redrawn_list.size(); k++) {
+		int top = groups.redrawn_list[k];
+		groups.redrawn[top] = 0;
+		if (!groups.alive[top]) { continue; }
+		bool lit_group = e.ith_group != 0 && groups.contains(e.ith_group, top);
+		stack.assign(1, top);
+		while (!stack.empty()) {
+			int g = stack.back();
+			stack.pop_back();
+			stack.insert(stack.end(), groups.children[g].begin(), groups.children[g].end());
+			const Affine2& w = groups.world[g];
+			float row[GROUP_FLOATS] = {w.a, w.b, w.c, w.d, w.x, w.y, 0.0f, 0.0f};
+			float* sent = &group_data[g * GROUP_FLOATS];
+			if (std::equal(row, row + GROUP_FLOATS, sent)) { continue; }
+			std::copy(row, row + GROUP_FLOATS, sent);
+			moved_groups.push_back(g);
+			static_changed = static_changed || !lit_group;
+		}
+	}
+	groups.redrawn_list.clear();
+	ranges = to_ranges(moved_groups, 16);
+	for (size_t k = 0; k < ranges.size(); k++) {
+		push_edit(EDIT_GROUPS, ranges[k].first, ranges[k].second, group_data.data(), sizeof(float) * GROUP_FLOATS, groups.count);
+	}
+	if (static_listed) { // the ones the culler keeps
+		std::vector<float> list;
+		for (size_t k = 0; k < culler.visible.size(); k++) {
+			int t = culler.visible[k];
+			if (t < tri.slots && slot_layer[t] == SLOT_STATIC && culler.at(t) == CULL_DRAWN) { list.push_back(float(t)); }
+		}
+		std::sort(list.begin(), list.end());
+		push_edit(EDIT_STATIC_LIST, 0, (int)list.size(), list.data(), sizeof(float), (int)list.size());
+	}
+	if (dynamic_listed) { // all of them, an animated one may leave its box
+		std::vector<float> list(dynamic_slots.items.begin(), dynamic_slots.items.end());
+		std::sort(list.begin(), list.end());
+		push_edit(EDIT_DYNAMIC_LIST, 0, (int)list.size(), list.data(), sizeof(float), (int)list.size());
+	}
+	if (culled || geometry) { // the clusters, and their colors
+		publish_clusters(&slot_data[11], SLOT_FLOATS);
+	}
+	if (static_changed) { static_serial ++; }
+	s.static_serial = static_serial;
+	s.draw_order.clear();
+	if (!batched) { // the fallback draws one by one, bottom to top
+		for (int t = tri.head; t != -1; t = tri.next[t]) {
+			if (slot_layer[t] == SLOT_DYNAMIC || culler.at(t) == CULL_DRAWN) { s.draw_order.push_back(t); }
+		}
+	}
+
+	s.shape_first = e.shapes.first;
+	s.shape_size = e.shapes.size;
+	s.shape_first_instance = e.shapes.first_instance;
+	s.shape_instances.clear();
+	s.shape_barycenter.clear();
+	s.shape_phase.clear();
+	for (int k = 0; k < e.shapes.count(); k++) {
+		s.shape_instances.push_back(e.shapes.instance_count(k));
+		s.shape_barycenter.push_back(e.shapes.barycenter[k](0));
+		s.shape_barycenter.push_back(e.shapes.barycenter[k](1));
+		s.shape_phase.push_back(floor(e.shapes.position[e.shapes.first[k] * 2]*1000));
+	}
+
+	snapshots.publish();
+	frame_serial ++;
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake_pending = true;
+	}
+	wake.notify_one();
+}
+
+// Callback Functions: they only queue the input, applied by apply_input once per frame.
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-	glViewport(0, 0, width, height);
+	redraw = true;
+}
+
+void window_refresh_callback(GLFWwindow* window) {
+	redraw = true;
 }
 
 void mouse_move_callback(GLFWwindow* window, double xpos, double ypos) {
+	input.move(xpos, ypos);
+}
+
+void mouse_click_callback(GLFWwindow* window, int button, int action, int mods) {
+	input.button(button, action, mods);
+}
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	input.key(key, scancode, action, mods);
+}
+
+void on_mouse_move(GLFWwindow* window, double xpos, double ypos) {
 	// Get the size of the window.
 	int width, height;
 	glfwGetCursorPos(window, &xpos, &ypos);
@@ -33,49 +567,62 @@ void mouse_move_callback(GLFWwindow* window, double xpos, double ypos) {
 		e.p0 = e.p1;
 		e.p1 = world_coord_2d;
 	} else { e.p0 = e.p1 = world_coord_2d; }
-	// The last column of V stores position value of cursor.
+	// Highlight the triangle under the cursor while nothing is being dragged.
+	bool picking = e.mode == TRANSLATION_MODE || e.mode == DELETE_MODE || e.mode == ANIMATION_MODE;
+	if (picking && !e.triangle_clicked) { e.hover_triangle = e.hover_at(pixel, width, height); }
+	else { e.hover_triangle = -1; }
+	// The last column of preview stores position value of cursor.
 	if (e.mode == INSERT_MODE && (e.insert_step == 1 || e.insert_step == 2)) {
-		e.V.col(e.V.cols()-1) << e.p1(0), e.p1(1), e.V(2, e.V.cols()-1), e.V(3, e.V.cols()-1);
-		VBO.update(e.V);
+		e.preview.col(e.preview.cols()-1) << e.p1(0), e.p1(1);
 	} // Implement the drag effect below
+	if (e.mode == TRANSLATION_MODE && e.select_step != 0) {
+		e.extend_selection();
+	}
 	if (e.mode == TRANSLATION_MODE && e.ith_triangle != -1 && e.triangle_clicked) {
-		e.translation(0, e.ith_triangle * 4 + 3) += (e.p1(0) - e.p0(0));
-		e.translation(1, e.ith_triangle * 4 + 3) += (e.p1(1) - e.p0(1));
+		if (e.selection.contains(e.ith_triangle)) { // a selected triangle drags the whole selection
+			e.translate_selection(e.p1(0) - e.p0(0), e.p1(1) - e.p0(1));
+		} else if (e.ith_group != 0) { // a grouped triangle drags its whole group
+			e.groups.translation[e.ith_group * 2] += (e.p1(0) - e.p0(0));
+			e.groups.translation[e.ith_group * 2 + 1] += (e.p1(1) - e.p0(1));
+			e.groups.mark_dirty(e.ith_group);
+		} else {
+			e.triangles.translation[e.ith_triangle * 2] += (e.p1(0) - e.p0(0));
+			e.triangles.translation[e.ith_triangle * 2 + 1] += (e.p1(1) - e.p0(1));
+			e.triangles.mark_dirty(e.ith_triangle);
+		}
 	} // Special case for handling bezier curve.
 	if (e.mode == BEZIER_CURVE_MODE && (e.bezier_step == 1 || e.bezier_step == 2 || e.bezier_step == 3)) {
-		e.V.col(e.V.cols()-1) << e.p1(0), e.p1(1), e.V(2, e.V.cols()-1), e.V(3, e.V.cols()-1);
-		VBO.update(e.V);
+		e.preview.col(e.preview.cols()-1) << e.p1(0), e.p1(1);
 	}
 	if (e.mode == BEZIER_CURVE_MODE && (e.bezier_step == 5)) {
-		e.V(0,e.closest_vertex) += (e.p1(0) - e.p0(0));
-		e.V(1,e.closest_vertex) += (e.p1(1) - e.p0(1));
-		VBO.update(e.V);
+		e.preview(0,e.closest_vertex) += (e.p1(0) - e.p0(0));
+		e.preview(1,e.closest_vertex) += (e.p1(1) - e.p0(1));
 	}
 }
 
-void mouse_click_callback(GLFWwindow* window, int button, int action, int mods) {
+void on_mouse_click(GLFWwindow* window, int button, int action, int mods) {
 	if (e.mode == INSERT_MODE && action == GLFW_PRESS) {
 		e.insert_step ++; //increment insert step
 		if (e.insert_step == 1) { // first click for insert
-			e.V.conservativeResize(4, e.triangle_count * 3 + 2);
-			e.V.col(e.triangle_count * 3) << e.p1(0), e.p1(1), 0.0, 0.0;
-			e.V.col(e.triangle_count * 3 + 1) << e.p1(0), e.p1(1), 0.0, 0.0;
+			e.preview.resize(2, 2);
+			e.preview.col(0) << e.p1(0), e.p1(1);
+			e.preview.col(1) << e.p1(0), e.p1(1);
 		}
     	else if (e.insert_step == 2) {
-    		e.V.conservativeResize(4, e.triangle_count * 3 + 3);
-    		e.V.col(e.triangle_count * 3 + 2) << e.p1(0), e.p1(1), 0.0, 0.0;
+    		e.preview.conservativeResize(2, 3);
+    		e.preview.col(2) << e.p1(0), e.p1(1);
     	}
     	else if (e.insert_step == 3) {
-			for (int j = 0; j < 3; j++) {
-				e.V(2,e.triangle_count * 3 + j) = -1.0;
-				e.V(3,e.triangle_count * 3 + j) = 0.0;
-			}
 			e.insert_step = 0; // After one insert is finished, reset insert_step to be 0.
-			e.model_matrix_expand(); // Initialize matrix for this triangle.
+			e.insert_triangle(); // Move the preview into the triangle store.
     	}
     } 
     else if (e.mode == TRANSLATION_MODE) {	
-		if (e.click_on_triangle(e.p1) && action == GLFW_RELEASE) { e.triangle_clicked = false; }
+		if (action == GLFW_RELEASE && e.select_step != 0) { e.end_selection(); }
+		else if (e.click_on_triangle(e.p1) && action == GLFW_RELEASE) { e.triangle_clicked = false; }
+		else if (!e.triangle_clicked && action == GLFW_PRESS) { // empty space: rubber band, lasso with shift
+			e.begin_selection((mods & GLFW_MOD_SHIFT) != 0);
+		}
     } 
     else if (e.mode == DELETE_MODE) {
 		if (e.click_on_triangle(e.p1) && action == GLFW_PRESS) { // down edge: delete triangle
@@ -88,53 +635,69 @@ void mouse_click_callback(GLFWwindow* window, int button, int action, int mods)
 		}
     }
     else if (e.mode == COLORIZE_MODE) {
-    	e.find_closest_vertex(0, (int)e.V.cols(), 3);
+    	e.find_closest_vertex();
     }
 	else if (e.mode == ANIMATION_MODE) {
 		if (e.ith_triangle != -1 && action == GLFW_PRESS) { e.ith_triangle = -1; }
 		else if (e.click_on_triangle(e.p1) && action == GLFW_RELEASE) { e.triangle_clicked = false; }
 
 		if (e.ith_triangle != -1) {
-			e.V(3,e.ith_triangle * 3) = e.animation_type;
-			e.V(3,e.ith_triangle * 3+1) = e.animation_type;
-			e.V(3,e.ith_triangle * 3+2) = e.animation_type;
-			VBO.update(e.V);
+			e.set_animation(e.ith_triangle, e.animation_type);
 		}
 	}
 	else if (e.mode == BEZIER_CURVE_MODE) {
 		if (action == GLFW_PRESS) {
 			e.bezier_step ++;
 			if (e.bezier_step == 1) {
-				e.V.conservativeResize(4, e.triangle_count * 3 + 2);
-				e.V.col(e.triangle_count * 3) << e.p1(0), e.p1(1), 0.0, 0.0;
-				e.V.col(e.triangle_count * 3 + 1) << e.p1(0), e.p1(1), 0.0, 0.0;
+				e.preview.resize(2, 2);
+				e.preview.col(0) << e.p1(0), e.p1(1);
+				e.preview.col(1) << e.p1(0), e.p1(1);
 			}
 			else if (e.bezier_step == 2 || e.bezier_step == 3) {
-				e.V.conservativeResize(4, e.triangle_count * 3 + e.bezier_step + 1);
-				e.V.col(e.triangle_count * 3 + e.bezier_step) << e.p1(0), e.p1(1), 0.0, 0.0;
+				e.preview.conservativeResize(2, e.bezier_step + 1);
+				e.preview.col(e.bezier_step) << e.p1(0), e.p1(1);
 			}
 			else if (e.bezier_step == 4) {
-				e.V.conservativeResize(4, e.triangle_count * 3 + 4 + 100);
-				e.V.rightCols(100) = MatrixXf::Zero(4,100);
+				e.preview.conservativeResize(2, 4 + 100);
+				e.preview.rightCols(100) = MatrixXf::Zero(2,100);
 			}
 			else if (e.bezier_step == 5) {
-				e.find_closest_vertex(e.triangle_count * 3, e.triangle_count * 3 + 4, 4);
+				e.find_closest_control_point();
 			}
     	}
     	else if (action == GLFW_RELEASE && e.bezier_step == 5) {
     		e.bezier_step = 4;
     	}
 	}
-    else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-        e.V.col(0) << e.p1(0), e.p1(1), e.V(2, 0), e.V(3, 0);     // Update the position of the first vertex if the left button is pressed
+    else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && e.triangles.alive[0]) {
+        e.triangles.move_vertex(e.triangles.index[0], e.p1(0), e.p1(1));     // Update the position of the first vertex if the left button is pressed
+        e.touch_all(); // every triangle sharing it changed shape
     }
-    VBO.update(e.V); // Upload the change to the GPU
 }
 
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+void on_key(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	if (key == GLFW_KEY_R && action == GLFW_RELEASE) {
+		std::cout << "ID buffer: " << e.id_buffer.hits << " hits, " << e.id_buffer.misses << " misses." << std::endl;
+		report_lookups = true;
+		std::cout << "Uploads: " << upload_frame.load() << " bytes last frame, " << upload_peak.load() << " at most." << std::endl;
+		std::cout << "Frames: " << frames.load() << " drawn in " << render_time.load() / 1e6 << " s, " << static_frames.load() << " drew the static layer. Input thread: idle " << idle_time << " s, busy " << busy_time << " s, "
+			<< input.received << " events (" << input.coalesced << " moves coalesced)." << std::endl;
+		std::cout << "Clock: " << scene_clock.time() << " s, tick " << scene_clock.frame << ", rate " << scene_clock.rate
+			<< (scene_clock.lockstep ? " steps per tick" : "") << (scene_clock.paused ? ", paused" : "") << "." << std::endl;
+		std::cout << "Culling: " << culler.drawn << " triangles in view, " << culler.merged << " merged below a pixel in " << culler.cluster_cell.size() << " clusters, of " << e.triangles.count << "." << std::endl;
+	}
+	if (key == GLFW_KEY_T && action == GLFW_RELEASE) {
+		batched = !batched;
+		std::cout << (batched ? "Batched" : "Per-triangle") << " scene rendering." << std::endl;
+	}
 	if (key == GLFW_KEY_Z && action == GLFW_RELEASE) { std::cout << "view:\n" << e.view << "\n" << std::endl; }
-	if (key == GLFW_KEY_X && action == GLFW_RELEASE) { std::cout << "model:\n" << e.model << "\n" << std::endl; }
-	if (key == GLFW_KEY_V && action == GLFW_RELEASE) { std::cout << "Vertex:\n" << e.V << "\n" << std::endl; }
+	if (key == GLFW_KEY_X && action == GLFW_RELEASE) {
+		e.triangles.compose_dirty();
+		std::cout << "model:\n" << Eigen::Map<Eigen::MatrixXf>(&e.triangles.model[0].a, 2, e.triangles.slots * 3) << "\n" << std::endl;
+	}
+	if (key == GLFW_KEY_V && action == GLFW_RELEASE) {
+		std::cout << "Vertex:\n" << Eigen::Map<Eigen::MatrixXf>(e.triangles.position.data(), 2, e.triangles.vertex_slots) << "\n" << std::endl;
+	}
 	if (key == GLFW_KEY_N && action == GLFW_RELEASE) { std::cout << "triangle_clicked: " << e.triangle_clicked << "  ith_triangle: " << e.ith_triangle << "\n" << std::endl; }
 	if (key == GLFW_KEY_M && action == GLFW_RELEASE) { std::cout << "closest_vertex:\n" << e.closest_vertex << "\n" << std::endl; }
 
@@ -149,15 +712,22 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	else if (key == GLFW_KEY_J && action == GLFW_RELEASE) { e.rotate_by(10,0); }
 	else if (key == GLFW_KEY_K && action == GLFW_RELEASE) { e.scale_by(0.25,1); }
 	else if (key == GLFW_KEY_L && action == GLFW_RELEASE) { e.scale_by(0.25,0); }
+	else if (key == GLFW_KEY_G && action == GLFW_RELEASE && e.mode == TRANSLATION_MODE) { e.group_clicked(); }
+	else if (key == GLFW_KEY_ENTER && action == GLFW_RELEASE && e.mode == TRANSLATION_MODE) { e.key_clicked(); }
+	else if (key == GLFW_KEY_BACKSLASH && action == GLFW_RELEASE && e.mode == TRANSLATION_MODE) { e.toggle_interpolation_clicked(); }
+	else if (key == GLFW_KEY_F && action == GLFW_RELEASE && e.mode == TRANSLATION_MODE) { e.ungroup_clicked(); }
+	else if (key == GLFW_KEY_B && action == GLFW_RELEASE && e.mode == TRANSLATION_MODE) { e.stamp_clicked(); }
 
 	else if (key >= 49 && key <= 57 && e.mode == COLORIZE_MODE) {
-		e.V(2, e.closest_vertex) = float(key - 48); 
+		if (!e.selection.empty()) { e.colorize_selection(float(key - 48)); }
+		else if (e.closest_vertex != -1) {
+			e.triangles.set_corner_color(e.closest_vertex / 3, e.closest_vertex % 3, float(key - 48)); // recolors every corner welded to it
+		}
 	}
 	else if (key >= 49 && key <= 55 && e.mode == ANIMATION_MODE) {
 		e.animation_type = key - 48;
-		e.V(3,e.ith_triangle * 3) = e.animation_type;
-		e.V(3,e.ith_triangle * 3+1) = e.animation_type;
-		e.V(3,e.ith_triangle * 3+2) = e.animation_type;
+		if (e.ith_triangle != -1) { e.set_animation(e.ith_triangle, e.animation_type); }
+		e.animate_selection(e.animation_type);
 	}
 	else if ((key == GLFW_KEY_MINUS || key == GLFW_KEY_EQUAL) && action == GLFW_RELEASE) {
 		if (key == GLFW_KEY_MINUS) {e.view.topLeftCorner(2,2) = e.view.topLeftCorner(2,2) * 0.8;}
@@ -175,22 +745,463 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		e.switch_mode(0);
 	}
 	else if (key == GLFW_KEY_Q && action == GLFW_RELEASE) { e.switch_mode(QUIT_MODE); }
-	else if (key == GLFW_KEY_SPACE && action == GLFW_RELEASE) {
+	else if ((key == GLFW_KEY_TAB || key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT || key == GLFW_KEY_HOME || key == GLFW_KEY_END
+		|| key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_RELEASE) {
+		// Tab pauses, the arrows step a frame when paused and seek a second otherwise, Home
+		// goes back to 0, the brackets halve and double the rate, End toggles the lockstep.
+		if (key == GLFW_KEY_TAB) { scene_clock.pause(!scene_clock.paused); }
+		if (key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT) {
+			int sign = key == GLFW_KEY_LEFT ? -1 : 1;
+			if (scene_clock.paused) { scene_clock.step_by(sign); }
+			else { scene_clock.seek(scene_clock.time() + sign); }
+		}
+		if (key == GLFW_KEY_HOME) { scene_clock.seek(0); }
+		if (key == GLFW_KEY_LEFT_BRACKET) { scene_clock.rate *= 0.5; }
+		if (key == GLFW_KEY_RIGHT_BRACKET) { scene_clock.rate *= 2.0; }
+		if (key == GLFW_KEY_END) { scene_clock.lockstep = !scene_clock.lockstep; }
+		std::cout << "Clock: " << scene_clock.time() << " s, rate " << scene_clock.rate << (scene_clock.lockstep ? " steps per tick" : "")
+			<< (scene_clock.paused ? ", paused" : "") << "." << std::endl;
+	}
+	else if (key == GLFW_KEY_SPACE && action == GLFW_RELEASE) { // with shift: the animations, as SMIL
+		bool animated = (mods & GLFW_MOD_SHIFT) != 0;
 		char filename[100];
-		sprintf(filename, "snap%d.svg", e.snap_num);
-		e.screenshot(filename);
+		sprintf(filename, animated ? "anim%d.svg" : "snap%d.svg", e.snap_num);
+		e.screenshot(filename, animated);
 		e.snap_num ++;
 	}
-    VBO.update(e.V); // Upload the change to the GPU
+}
+
+// Apply the queued input in order. Returns whether there was any.
+bool apply_input(GLFWwindow* window) {
+	if (input.empty()) { return false; }
+	for (size_t k = 0; k < input.events.size(); k++) {
+		const InputEvent& event = input.events[k];
+		if (event.type == INPUT_MOVE) { on_mouse_move(window, event.x, event.y); }
+		else if (event.type == INPUT_BUTTON) { on_mouse_click(window, event.code, event.action, event.mods); }
+		else { on_key(window, event.code, event.scancode, event.action, event.mods); }
+	}
+	input.clear();
+	return true;
+}
+
+// Render thread
+
+void apply_edit(const SceneEdit& edit) {
+	const float* data = (const float*)edit.bytes.data();
+	if (edit.target == EDIT_POSITIONS) { positions.write(edit.first, data, edit.bytes.size() / positions.size, edit.count); }
+	else if (edit.target == EDIT_COLORS) { colors.write(edit.first, data, edit.bytes.size() / colors.size, edit.count); }
+	else if (edit.target == EDIT_INDICES) { indices.write(edit.first, data, edit.bytes.size() / indices.size, edit.count); }
+	else if (edit.target == EDIT_SHAPE_POSITIONS) { VBO_shape.update(data, 2, edit.count); }
+	else if (edit.target == EDIT_SHAPE_COLORS) { VBO_shape_color.update(data, 1, edit.count); }
+	else if (edit.target == EDIT_INSTANCES) { VBO_instance.update(data, INSTANCE_FLOATS, edit.count); }
+	else if (edit.target == EDIT_CLUSTER_POSITIONS) { VBO_cluster_position.update(data, 3, edit.count); }
+	else if (edit.target == EDIT_CLUSTER_COLORS) { VBO_cluster_color.update(data, 3, edit.count); }
+	else if (edit.target == EDIT_SLOTS) {
+		batch_data.write(edit.first, data, edit.bytes.size() / batch_data.size, edit.count);
+		batch_copy.resize(edit.count * SLOT_FLOATS, 0.0f);
+		std::copy(data, data + edit.bytes.size() / sizeof(float), &batch_copy[edit.first * SLOT_FLOATS]);
+	}
+	else if (edit.target == EDIT_GROUPS) {
+		group_table.resize(edit.count * GROUP_FLOATS, 0.0f);
+		std::copy(data, data + edit.bytes.size() / sizeof(float), &group_table[edit.first * GROUP_FLOATS]);
+		VBO_groups.mark_dirty(edit.first, edit.first + (int)(edit.bytes.size() / (sizeof(float) * GROUP_FLOATS)));
+		VBO_groups.upload(group_table.data(), GROUP_FLOATS, edit.count);
+	}
+	else if (edit.target == EDIT_STATIC_LIST) {
+		static_list.assign(data, data + edit.count);
+		if (edit.count > 0) { VBO_listed.update(data, 1, edit.count); }
+	}
+	else if (edit.target == EDIT_DYNAMIC_LIST) {
+		dynamic_list.assign(data, data + edit.count);
+		if (edit.count > 0) { VBO_dynamic.update(data, 1, edit.count); }
+	}
+	else if (edit.target == EDIT_RELEASE) {
+		PagedBuffer* paged[] = {&positions, &colors, &indices, &batch_data};
+		for (size_t k = 0; k < sizeof(paged) / sizeof(paged[0]); k++) { paged[k]->release(edit.first); }
+	}
+}
+
+// Bytes sent by all the buffer objects since the last call.
+size_t take_uploaded() {
+	VertexBufferObject* vbos[] = {&VBO_preview, &VBO_shape, &VBO_shape_color, &VBO_instance, &VBO_listed, &VBO_dynamic, &VBO_groups, &VBO_cluster_position, &VBO_cluster_color};
+	PagedBuffer* paged[] = {&positions, &colors, &indices, &batch_data};
+	size_t bytes = 0;
+	for (size_t k = 0; k < sizeof(vbos) / sizeof(vbos[0]); k++) {
+		bytes += vbos[k]->uploaded;
+		vbos[k]->uploaded = 0;
+	}
+	for (size_t k = 0; k < sizeof(paged) / sizeof(paged[0]); k++) {
+		bytes += paged[k]->uploaded;
+		paged[k]->uploaded = 0;
+	}
+	return bytes;
+}
+
+// Connect the buffers of page p of the triangle store with the "position" and "color_code"
+// slots of the vertex shader. The indices of the page are global vertex slots, they are drawn
+// with a base vertex of -p * PAGE_VERTICES.
+void bind_scene(Program& program, int p = 0) {
+	if (p >= (int)positions.pages.size() || positions.pages[p] == 0) { // nothing stored there
+		GLint position = program.attrib("position"), color = program.attrib("color_code");
+		if (position >= 0) { glDisableVertexAttribArray(position); }
+		if (color >= 0) { glDisableVertexAttribArray(color); }
+		return;
+	}
+	program.bindVertexAttribArray("position", positions.pages[p], 2);
+	program.bindVertexAttribArray("color_code", colors.pages[p], 1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p < (int)indices.pages.size() ? indices.pages[p] : 0);
+}
+
+// The preview is drawn in black: its color slot reads the constant 0 instead of a buffer.
+void bind_preview(Program& program) {
+	program.bindVertexAttribArray("position",VBO_preview);
+	GLint color = program.attrib("color_code");
+	if (color >= 0) {
+		glDisableVertexAttribArray(color);
+		glVertexAttrib1f(color, 0.0);
+	}
+}
+
+// Draw the triangles of the ascending slots list, held by vbo, with the batched program,
+// one call per page, the dragged ones shifted by drag.
+void draw_pages(Program& batch, const std::vector<float>& list, VertexBufferObject& vbo, const Eigen::Vector2f& drag) {
+	if (list.empty()) { return; }
+	batch.bind();
+	glUniform1i(batch.uniform("triangles"), 0);
+	glUniform1i(batch.uniform("indices"), 1);
+	glUniform1i(batch.uniform("positions"), 2);
+	glUniform1i(batch.uniform("colors"), 3);
+	glUniform1i(batch.uniform("list"), 4);
+	glUniform1i(batch.uniform("groups"), 5);
+	glUniform2f(batch.uniform("drag"), drag(0), drag(1));
+	glUniform1i(batch.uniform("click"), 0);
+	TBO_listed.attach(vbo.id, GL_R32F);
+	TBO_listed.bind(4);
+	TBO_groups.attach(VBO_groups.id, GL_RGBA32F);
+	TBO_groups.bind(5);
+	glEnable(GL_DEPTH_TEST); // the draw order is in the depth
+	int d = 0, last = (int)list.size(); // first listed slot of the page
+	for (int p = 0; p < (int)batch_data.pages.size() && p < (int)indices.pages.size() && d < last; p++) {
+		int start = d;
+		while (d < last && list[d] < (p + 1) * PAGE_TRIANGLES) { d++; }
+		if (d == start) { continue; }
+		TBO_batch.attach(batch_data.pages[p], GL_RGBA32F);
+		TBO_indices.attach(indices.pages[p], GL_R32UI);
+		TBO_positions.attach(positions.pages[p], GL_RG32F);
+		TBO_colors.attach(colors.pages[p], GL_R32F);
+		TBO_batch.bind(0);
+		TBO_indices.bind(1);
+		TBO_positions.bind(2);
+		TBO_colors.bind(3);
+		glUniform1i(batch.uniform("vertex_base"), p * PAGE_VERTICES);
+		glUniform1i(batch.uniform("slot_base"), p * PAGE_TRIANGLES);
+		glDrawArrays(GL_TRIANGLES, start * 3, (d - start) * 3);
+	}
+	glDisable(GL_DEPTH_TEST);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Draw the clusters of small triangles, with the depth test if depth.
+void draw_clusters(Program& clusters, bool depth) {
+	if (VBO_cluster_position.cols == 0) { return; }
+	clusters.bind();
+	GLint position = clusters.bindVertexAttribArray("position", VBO_cluster_position);
+	GLint color = clusters.bindVertexAttribArray("cluster_color", VBO_cluster_color);
+	if (depth) { glEnable(GL_DEPTH_TEST); }
+	glDrawArrays(GL_TRIANGLES, 0, VBO_cluster_position.cols);
+	if (depth) { glDisable(GL_DEPTH_TEST); }
+	if (position >= 0) { glDisableVertexAttribArray(position); } // the other programs bind their own
+	if (color >= 0) { glDisableVertexAttribArray(color); }
+}
+
+// Draw the snapshot s. fresh tells it was just acquired, its per-frame buffers are sent then.
+void draw_frame(Program& program, Program& batch, Program& clusters, DrawUniforms& u, const FrameSnapshot& s, bool fresh, float time) {
+	glViewport(0, 0, s.framebuffer_width, s.framebuffer_height);
+	program.bind();
+	u.resolve(program);
+	glUniform4f(u.tint, 0, 0, 0, 0);
+	if (report_lookups.exchange(false)) { program.print_lookups(); }
+
+	// The following line connects the VBO we defined above with the position "slot" in the vertex shader
+	bind_scene(program); // The vertex shader wants the position of the vertices as an input.
+	if (fresh && s.preview_cols > 0) { VBO_preview.update(s.preview.data(), 2, s.preview_cols); }
+
+	FrameBlock frame;
+	std::copy(s.view.data(), s.view.data() + 16, frame.view);
+	frame.time = time;
+	frame.animated = s.mode == ANIMATION_MODE;
+	AnimationTable table; // every animated vertex reads its transform from it
+	table.evaluate(time, frame.animated);
+	frame.set_animation(table);
+	UBO_frame.update(&frame);
+
+	// The batched path starts from the cached static layer, its depth included, so the
+	// dynamic triangles drawn over it still go under the static ones above them.
+	bool layered = s.mode != BEZIER_CURVE_MODE && s.batched && s.framebuffer_width > 0 && s.framebuffer_height > 0;
+	if (layered) {
+		if (!static_valid || static_drawn != s.static_serial || static_view != s.view
+			|| FBO_static.width != s.framebuffer_width || FBO_static.height != s.framebuffer_height) {
+			FBO_static.resize(s.framebuffer_width, s.framebuffer_height, window_samples);
+			FBO_static.bind();
+			glClearColor(1.0f, 1.0f, 1.0f, 0.4f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			draw_pages(batch, static_list, VBO_listed, s.selection_drag);
+			draw_clusters(clusters, true);
+			FBO_static.bind(false);
+			static_valid = true;
+			static_drawn = s.static_serial;
+			static_view = s.view;
+			static_frames ++;
+		}
+		FBO_static.blit();
+		program.bind();
+	} else { // Clear the framebuffer
+		glClearColor(1.0f, 1.0f, 1.0f, 0.4f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	Affine2 identity = Affine2::identity();
+	if (s.mode != BEZIER_CURVE_MODE) {
+		if (s.mode == INSERT_MODE && s.insert_step >= 1) {
+			bind_preview(program);
+			glUniform1f(u.animation, 0.0);
+			glUniformMatrix3x2fv(u.group, 1, GL_FALSE, identity.data());
+			if (s.insert_step == 1){
+				glUniformMatrix3x2fv(u.model, 1, GL_FALSE, identity.data());
+				glDrawArrays(GL_LINES, 0, 2);
+			} 
+			else if (s.insert_step ==  2){ //Display 3 lines
+				glUniformMatrix3x2fv(u.model, 1, GL_FALSE, identity.data());
+				glDrawArrays(GL_LINE_LOOP, 0, 3);
+			}
+			bind_scene(program);
+		}
+		if (layered) { // the dynamic triangles over the static layer, one draw call per page
+			draw_pages(batch, dynamic_list, VBO_dynamic, s.selection_drag);
+			program.bind();
+		} else { // Draw triangles in draw order, one call each, the world transform as the model
+			draw_clusters(clusters, false); // under everything, without the depth of the others
+			program.bind();
+			bind_scene(program);
+			int current_page = 0;
+			int current_click = -1, current_highlight = -1, current_group = 0, current_dragged = 0; // uniforms only set when they change
+			bool current_tint = false;
+			float current_animation = -1;
+			glUniformMatrix3x2fv(u.group, 1, GL_FALSE, identity.data());
+			for (size_t k = 0; k < s.draw_order.size(); k++) {
+				int t = s.draw_order[k];
+				if ((t + 1) * SLOT_FLOATS > (int)batch_copy.size()) { continue; } // its data has not arrived yet
+				const float* d = &batch_copy[t * SLOT_FLOATS];
+				int flags = int(d[10]) & 15, group = int(d[10]) >> 4;
+				int dragged = (flags & 8) != 0;
+				if ((group != current_group || dragged != current_dragged) && (group + 1) * GROUP_FLOATS <= (int)group_table.size()) {
+					float world[6]; // of the group, shifted by the drag
+					std::copy(&group_table[group * GROUP_FLOATS], &group_table[group * GROUP_FLOATS] + 6, world);
+					if (dragged) { world[4] += s.selection_drag(0); world[5] += s.selection_drag(1); }
+					glUniformMatrix3x2fv(u.group, 1, GL_FALSE, world);
+					current_group = group;
+					current_dragged = dragged;
+				}
+				int click = (flags & 2) != 0;
+				if (click != current_click) { glUniform1i(u.click, click); current_click = click; }
+
+				int highlight = flags & 1;
+				if (highlight != current_highlight) { glUniform1i(u.is_ith_triangle, highlight); current_highlight = highlight; }
+
+				glUniform2f(u.barycenter, d[6], d[7]);
+				glUniform1f(u.phase, d[8]);
+				if (d[9] != current_animation) {
+					current_animation = d[9];
+					glUniform1f(u.animation, current_animation);
+				}
+
+				bool tinted = d[15] != 0;
+				if (tinted || current_tint) { glUniform4fv(u.tint, 1, d + 12); current_tint = tinted; }
+
+				glUniformMatrix3x2fv(u.model, 1, GL_FALSE, d);
+				int page = t / PAGE_TRIANGLES;
+				if (page >= (int)indices.pages.size() || indices.pages[page] == 0) { continue; } // its geometry has not arrived yet
+				if (page != current_page) { bind_scene(program, page); current_page = page; }
+				glDrawElementsBaseVertex(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * (t - page * PAGE_TRIANGLES) * 3), -page * PAGE_VERTICES);
+			}
+		}
+		// Draw the shape instances, one instanced draw call per shape
+		if (!s.shape_first.empty()) {
+			glUniformMatrix3x2fv(u.group, 1, GL_FALSE, identity.data());
+			glUniform1i(u.click, 0);
+			glUniform1i(u.is_ith_triangle, 0);
+			glUniform4f(u.tint, 0, 0, 0, 0);
+			glUniform1i(u.instanced, 1);
+			program.bindVertexAttribArray("position",VBO_shape);
+			program.bindVertexAttribArray("color_code",VBO_shape_color);
+			for (size_t k = 0; k < s.shape_first.size(); k++) {
+				int n = s.shape_instances[k];
+				if (n == 0) { continue; }
+				program.bindInstanceAttribArray("instance_model", VBO_instance, 2, 3, s.shape_first_instance[k] * INSTANCE_FLOATS);
+				program.bindInstanceAttribArray("instance_style", VBO_instance, 2, 1, s.shape_first_instance[k] * INSTANCE_FLOATS + 6);
+				glUniform2f(u.barycenter, s.shape_barycenter[k * 2], s.shape_barycenter[k * 2 + 1]);
+				glUniform1f(u.phase, s.shape_phase[k]);
+				glDrawArraysInstanced(GL_TRIANGLES, s.shape_first[k], s.shape_size[k], n);
+			}
+			program.unbindInstanceAttribArray("instance_model", 3);
+			program.unbindInstanceAttribArray("instance_style", 1);
+			glUniform1i(u.instanced, 0);
+			bind_scene(program);
+		}
+		// Draw the rubber band or lasso being dragged on top
+		if (s.mode == TRANSLATION_MODE && s.select_step != 0) {
+			bind_preview(program);
+			glUniform1f(u.animation, 0.0);
+			glUniform1i(u.is_ith_triangle, 0);
+			glUniformMatrix3x2fv(u.group, 1, GL_FALSE, identity.data());
+			glUniformMatrix3x2fv(u.model, 1, GL_FALSE, identity.data());
+			glDrawArrays(GL_LINE_LOOP, 0, s.preview_cols);
+			bind_scene(program);
+		}
+	}
+	else if (s.mode == BEZIER_CURVE_MODE) {
+		bind_preview(program);
+		glUniform1f(u.animation, 0.0);
+		glUniformMatrix3x2fv(u.group, 1, GL_FALSE, identity.data());
+		glUniformMatrix3x2fv(u.model, 1, GL_FALSE, identity.data());
+		if (s.bezier_step == 1){
+			glDrawArrays(GL_LINES, 0, 2);
+		}
+		else if (s.bezier_step ==  2){ //Display 3 lines
+			glDrawArrays(GL_LINE_STRIP, 0, 3);
+		}
+		else if (s.bezier_step ==  3){ //Display 4 lines
+			glDrawArrays(GL_LINE_STRIP, 0, 4);
+		}
+		else if (s.bezier_step >=  4) { // The control polygon, then the curve sampled by publish_frame
+			glDrawArrays(GL_LINE_STRIP, 0, 4);
+			glDrawArrays(GL_LINE_STRIP, 4, 100);
+		}
+	}
+}
+
+// The render thread: owns the GL context and every GL object. It sleeps until a snapshot is
+// published, or keeps drawing while the last one animates; the wait times out now and then
+// to check the shader files.
+void render_loop(GLFWwindow* window) {
+	glfwMakeContextCurrent(window);
+								// Initialize the VAO
+	VertexArrayObject VAO;		// A Vertex Array Object (or VAO) is an object that describes how the vertex
+	VAO.init();					// attributes are stored in a Vertex Buffer Object (or VBO). This means that
+	VAO.bind();					// the VAO is not the actual object storing the vertex data,
+								// but the descriptor of the vertex data.
+
+	positions.init(PAGE_VERTICES, sizeof(float) * 2); // The scene buffers are split in pages
+	colors.init(PAGE_VERTICES, sizeof(float));         // of buffer objects living in the GPU memory
+	indices.init(PAGE_TRIANGLES * 3, sizeof(unsigned int));
+	VBO_preview.init();
+	VBO_shape.init();
+	VBO_shape_color.init();
+	VBO_instance.init();
+	VBO_cluster_position.init();
+	VBO_cluster_color.init();
+
+					  	// Initialize the OpenGL Program
+	ProgramCache programs; 	// A program controls the OpenGL pipeline and it must contains
+	programs.init(shader_prelude()); // at least a vertex shader and a fragment shader to be valid
+						// The cache compiles it once and rebuilds it when a shader file is saved.
+	Program& program = programs.get("../src/vertex_shader.glsl","../src/fragment_shader.glsl","outColor"); // Compile the two shaders and upload the binary to the GPU
+	program.bind();          // Note that we have to explicitly specify that the output "slot" called outColor
+	                         // is the one that we want in the fragment buffer (and thus on screen)
+	Program& batch = programs.get("../src/vertex_shader_batched.glsl","../src/fragment_shader.glsl","outColor");
+	Program& clusters = programs.get("../src/vertex_shader_clusters.glsl","../src/fragment_shader.glsl","outColor");
+	UBO_frame.init(0, sizeof(FrameBlock));
+	program.uniform_block("Frame", UBO_frame);
+	batch.uniform_block("Frame", UBO_frame);
+	clusters.uniform_block("Frame", UBO_frame);
+	batch_data.init(PAGE_TRIANGLES, sizeof(float) * SLOT_FLOATS);
+	TBO_batch.init();
+	TBO_indices.init();
+	TBO_positions.init();
+	TBO_colors.init();
+	VBO_listed.init();
+	VBO_dynamic.init();
+	TBO_listed.init();
+	VBO_groups.init();
+	TBO_groups.init();
+	FBO_static.init();
+	glGetIntegerv(GL_SAMPLES, &window_samples);
+	DrawUniforms u;
+
+	bool started = false; // A snapshot was acquired.
+	while (!quit.load()) {
+		{
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			if (!wake_pending) {
+				wake.wait_for(lock, std::chrono::milliseconds(500), [] { return wake_pending || quit.load(); });
+			}
+			wake_pending = false;
+		}
+		if (quit.load()) { break; }
+		TimePoint frame_start = Clock::now();
+		bool fresh = snapshots.acquire();
+		bool changed = fresh;
+		const FrameSnapshot& s = snapshots.read_buffer();
+		// The edits up to the snapshot, not those the main thread already pushed for the next
+		// one: they may refer to slots its lists and draw order do not know yet.
+		SceneEdit edit;
+		while (edits.peek() && int(edits.peek()->serial - s.serial) <= 0) {
+			edits.pop(edit);
+			apply_edit(edit);
+			changed = true;
+		}
+		if (programs.poll()) { // Relink if a shader file changed; the last good program is kept otherwise
+			program.uniform_block("Frame", UBO_frame);
+			batch.uniform_block("Frame", UBO_frame);
+			clusters.uniform_block("Frame", UBO_frame);
+			static_valid = false;
+			changed = true;
+		}
+		started = started || fresh;
+		if (!started || !changed) { continue; }
+
+		VAO.bind();    // Bind your VAO (not necessary if you have only one)
+		draw_frame(program, batch, clusters, u, s, fresh, float(s.time));
+		upload_frame = take_uploaded();
+		upload_peak = std::max(upload_peak.load(), upload_frame.load());
+		glfwSwapBuffers(window); // Swap front and back buffers
+		frames ++;
+		render_time += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - frame_start).count();
+	}
+	// Deallocate opengl memory
+	programs.free();
+	UBO_frame.free();
+	batch_data.free();
+	TBO_batch.free();
+	TBO_indices.free();
+	TBO_positions.free();
+	TBO_colors.free();
+	VBO_listed.free();
+	VBO_dynamic.free();
+	TBO_listed.free();
+	VBO_groups.free();
+	TBO_groups.free();
+	FBO_static.free();
+	VAO.free();
+	positions.free();
+	colors.free();
+	indices.free();
+	VBO_preview.free();
+	VBO_shape.free();
+	VBO_shape_color.free();
+	VBO_instance.free();
+	VBO_cluster_position.free();
+	VBO_cluster_color.free();
+	glfwMakeContextCurrent(NULL);
 }
 
 // Main
-int main(void) {
+int main(int argc, char** argv) {
     GLFWwindow* window;
     if (!glfwInit()) { return -1; }     // Initialize the library
     glfwWindowHint(GLFW_SAMPLES, 8);    // Activate supersampling
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);    // Ensure that we get at least a 3.2 context
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);    // Ensure that we get at least a 3.3 context (instanced attributes)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 
     // On apple we have to load a core profile with forward compatibility
 	#ifdef __APPLE__
@@ -205,7 +1216,7 @@ int main(void) {
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window); // Make the window's context current
+    glfwMakeContextCurrent(window); // Make the window's context current, until the render thread takes it
 
     #ifndef __APPLE__
 		glewExperimental = true;
@@ -225,135 +1236,61 @@ int main(void) {
     printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
     printf("Supported OpenGL is %s\n", (const char*)glGetString(GL_VERSION));
     printf("Supported GLSL is %s\n", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+    glfwMakeContextCurrent(NULL);
 
     e.init();
-    							// Initialize the VAO
-    VertexArrayObject VAO;		// A Vertex Array Object (or VAO) is an object that describes how the vertex
-    VAO.init();					// attributes are stored in a Vertex Buffer Object (or VBO). This means that
-    VAO.bind();					// the VAO is not the actual object storing the vertex data,
-    							// but the descriptor of the vertex data.
-
-    VBO.init();           // Initialize the VBO with the vertices data
-    VBO.update(e.V);      // A VBO is a data container that lives in the GPU memory
-
-    				  	// Initialize the OpenGL Program
-    Program program; 	// A program controls the OpenGL pipeline and it must contains
-    					// at least a vertex shader and a fragment shader to be valid
-
-    program.init("../src/vertex_shader.glsl","../src/fragment_shader.glsl","outColor"); // Compile the two shaders and upload the binary to the GPU
-	program.bind();          // Note that we have to explicitly specify that the output "slot" called outColor
-	                         // is the one that we want in the fragment buffer (and thus on screen)
+    if (argc > 1) { e.import_off(argv[1]); } // Optional OFF mesh to start from
 
     glfwSetKeyCallback(window, key_callback);                 // Register the keyboard callback
     glfwSetMouseButtonCallback(window, mouse_click_callback); // Register the mouse callback
     glfwSetCursorPosCallback(window, mouse_move_callback);    // Register the cursor move callback
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback); // Update viewport
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback); // Redraw at the new size
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);     // Redraw when the window is exposed
+    input.init();
+    culler.init();
+    scene_clock.init(1.0 / 60);
 
-	TimePoint t_start = std::chrono::high_resolution_clock::now();
-    // Loop until the user closes the window
+    std::thread renderer(render_loop, window);
+    publish_frame(window);
+    redraw = false;
 
+    // Loop until the user closes the window. It sleeps in glfwWaitEvents until some input
+    // arrives, and publishes a frame when something changed. While the picture changes with
+    // time, it also wakes once per step of the clock, ticks it and publishes the frame: the
+    // scene time is read there only, the render thread draws at the time of the snapshot.
     while (!glfwWindowShouldClose(window) && e.mode != QUIT_MODE) {
-        VAO.bind();    // Bind your VAO (not necessary if you have only one)
-		program.init("../src/vertex_shader.glsl","../src/fragment_shader.glsl","outColor");
-		program.bind();
-
-		// The following line connects the VBO we defined above with the position "slot" in the vertex shader
-		program.bindVertexAttribArray("position",VBO); // The vertex shader wants the position of the vertices as an input.
-
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-		e.aspect_ratio = float(height)/float(width);
-		e.width = float(width);
-		e.height = float(height);
-		if (e.view(0,0)/e.view(1,1) != e.aspect_ratio) { e.view(0,0) = e.aspect_ratio * e.view(1,1); }
-
-        // Clear the framebuffer
-        glClearColor(1.0f, 1.0f, 1.0f, 0.4f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glUniformMatrix4fv(program.uniform("view"), 1, GL_FALSE, e.view.data());
-        glUniform1i(program.uniform("animated"), e.mode == ANIMATION_MODE);
-
-        if (e.mode != BEZIER_CURVE_MODE) {
-			if (e.mode == INSERT_MODE && e.insert_step >= 1) {
-				Eigen::Matrix4f identity = MatrixXf::Identity(4, 4);
-				if (e.insert_step == 1){
-					glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-					glDrawArrays(GL_LINES, (e.triangle_count * 3), 2);
-				} 
-				else if (e.insert_step ==  2){ //Display 3 lines
-					glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-					glDrawArrays(GL_LINE_LOOP, (e.triangle_count * 3), 3);
-				}
+		TimePoint wait_start = Clock::now();
+		if (animating) {
+			double now = glfwGetTime();
+			if (now < next_tick) { glfwWaitEventsTimeout(next_tick - now); }
+			else { glfwPollEvents(); }
+			now = glfwGetTime();
+			if (now >= next_tick) {
+				scene_clock.tick(now);
+				next_tick = std::max(next_tick + scene_clock.step, now); // late ticks are not caught up
+				redraw = true;
 			}
-			if (e.mode == TRANSLATION_MODE && e.ith_triangle != -1) {
-				Eigen::Matrix4f t_m = e.translation.block(0, e.ith_triangle * 4, 4, 4);
-				Eigen::Matrix4f r_m = e.rotation.block(0, e.ith_triangle * 4, 4, 4);
-				Eigen::Matrix4f s_m = e.scaling.block(0, e.ith_triangle * 4, 4, 4);
-				e.model.block(0, e.ith_triangle * 4, 4, 4) = t_m * r_m * s_m;
-			}
-			// Draw triangles
-			for (int i = 0; i < (e.triangle_count * 3); i += 3) {
-				if ((int)floor(i/3) == e.ith_triangle && e.ith_triangle != -1 && e.triangle_clicked) {
-					glUniform1i(program.uniform("click"), 1);
-				}  else { glUniform1i(program.uniform("click"), 0); }
-
-				glUniform1i(program.uniform("is_ith_triangle"), (int)floor(i/3) == e.ith_triangle);
-
-				Vector2f v1(e.V.col(i)(0), e.V.col(i)(1));
-				Vector2f v2(e.V.col(i+1)(0), e.V.col(i+1)(1));
-				Vector2f v3(e.V.col(i+2)(0), e.V.col(i+2)(1));
-				Vector2f barycenter ((v1(0)+v2(0)+v3(0))/3.0, (v1(1)+v2(1)+v3(1))/3.0) ;
-				glUniform2f(program.uniform("barycenter"), barycenter(0), barycenter(1));
-
-				auto t_now = std::chrono::high_resolution_clock::now();
-				float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
-				glUniform1f(program.uniform("time"), time + floor(v1(0)*1000));
-
-				glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, &e.model(0, (int)floor(i/3) * 4));
-				glDrawArrays(GL_TRIANGLES, i, 3);
-			}
-        }
-        else if (e.mode == BEZIER_CURVE_MODE) {
-        	Eigen::Matrix4f identity = MatrixXf::Identity(4, 4);
-        	if (e.bezier_step == 1){
-				glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-				glDrawArrays(GL_LINES, (e.triangle_count * 3), 2);
-        	}
-        	else if (e.bezier_step ==  2){ //Display 3 lines
-				glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-				glDrawArrays(GL_LINE_STRIP, (e.triangle_count * 3), 3);
-			}
-			else if (e.bezier_step ==  3){ //Display 4 lines
-				glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-				glDrawArrays(GL_LINE_STRIP, (e.triangle_count * 3), 4);
-			}
-			else if (e.bezier_step >=  4) {
-				glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, identity.data());
-				glDrawArrays(GL_LINE_STRIP, (e.triangle_count * 3), 4);
-
-				int i = e.triangle_count * 3;
-				Vector2f v1(e.V.col(i)(0), e.V.col(i)(1));
-				Vector2f v2(e.V.col(i+1)(0), e.V.col(i+1)(1));
-				Vector2f v3(e.V.col(i+2)(0), e.V.col(i+2)(1));
-				Vector2f v4(e.V.col(i+3)(0), e.V.col(i+3)(1));
-				for (int j=0; j < 100; j ++) {
-					float t = float(j)/100;
-					float bezier_x = e.bezier_curve(v1(0), v2(0), v3(0), v4(0), t);
-					float bezier_y = e.bezier_curve(v1(1), v2(1), v3(1), v4(1), t);
-
-					e.V.col(e.triangle_count * 3 + 4 + j) << bezier_x, bezier_y, 0.0;
-				}
-				glDrawArrays(GL_LINE_STRIP, (e.triangle_count * 3 + 4), 100);
-			}
-        }
-		glfwSwapBuffers(window); // Swap front and back buffers
-		glfwPollEvents(); // Poll for and process events
+		} else {
+			glfwWaitEvents();
+			next_tick = glfwGetTime();
+		}
+		TimePoint busy_start = Clock::now();
+		idle_time += std::chrono::duration<double>(busy_start - wait_start).count();
+
+		if (apply_input(window)) { redraw = true; }
+		if (redraw && e.mode != QUIT_MODE) {
+			publish_frame(window);
+			redraw = false;
+		}
+		busy_time += std::chrono::duration<double>(Clock::now() - busy_start).count();
+    }
+    quit = true;
+    {
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake_pending = true;
     }
-    // Deallocate opengl memory
-    program.free();
-    VAO.free();
-    VBO.free();
+    wake.notify_one();
+    renderer.join();
 
     // Deallocate glfw internals
     glfwTerminate();
@@ -46,6 +46,7 @@ inline bool read_off(const std::string filename, Eigen::MatrixXd & V, Eigen::Mat
 				V(i,2) = z;
 			} else {
 				printf("Read Error: incorrect line format.");
+				fclose(off_fp);
 				return false;
 			}
 		}
@@ -59,13 +60,14 @@ inline bool read_off(const std::string filename, Eigen::MatrixXd & V, Eigen::Mat
 				F(i,2) = i3;
 			} else {
 				printf("Read Error: incorrect line format.");
+				fclose(off_fp);
 				return false;
 			}
 		}
+		fclose(off_fp);
 		return true;
 	}
 
-	fclose(off_fp);
 	return false;
 }
 
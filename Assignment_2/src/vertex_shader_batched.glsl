@@ -0,0 +1,70 @@
+#version 150 core
+
+// Batched variant of vertex_shader.glsl: a page of the scene is one glDrawArrays of 3
+// vertices per listed triangle slot, with no vertex attributes. Vertex gl_VertexID is corner
+// gl_VertexID % 3 of the triangle whose slot is at gl_VertexID / 3 in the list, and
+// everything is fetched from the buffer textures of the page: 4 RGBA texels per triangle slot,
+//   (a, b, c, d) (x, y, barycenter) (phase, animation, flags, depth) (tint)
+// where a..y is the model transform, flags is 1 if highlighted plus 2 if clicked plus 4 if
+// dynamic plus 8 if dragged plus 16 times the group, and depth comes from the draw order,
+// the top triangle being the closest. tint is the color a color track gives the triangle,
+// if its alpha is 1. A dragged triangle is shifted by drag, in world space.
+// The world transform of the group is read from the group table, 2 RGBA texels per group,
+//   (a, b, c, d) (x, y, -, -)
+// so moving a group rewrites its row and none of its triangles.
+//
+// The list holds either the visible static triangles, drawn once into a cached layer, or
+// the dynamic ones, drawn over it every frame.
+uniform samplerBuffer triangles;
+uniform usamplerBuffer indices;  // 3 per triangle slot
+uniform samplerBuffer positions; // x,y per vertex
+uniform samplerBuffer colors;    // color code per vertex
+uniform int vertex_base;         // First vertex slot of the page, the indices are global
+uniform int slot_base;           // First triangle slot of the page, the listed slots are global
+uniform samplerBuffer list;      // Slots of the triangles to draw
+uniform samplerBuffer groups;    // World transform of each group
+uniform vec2 drag;               // World offset of the dragged triangles
+out vec3 f_color;
+
+// palette and the Frame block (view, time, animated, pulse, motion): see shader_prelude in Animation.h.
+
+void main()
+{
+	int k = int(texelFetch(list, gl_VertexID / 3).r) - slot_base;
+	vec4 t0 = texelFetch(triangles, k * 4);
+	vec4 t1 = texelFetch(triangles, k * 4 + 1);
+	vec4 t2 = texelFetch(triangles, k * 4 + 2);
+	vec4 tint = texelFetch(triangles, k * 4 + 3);
+	int v = int(texelFetch(indices, k * 3 + gl_VertexID % 3).r) - vertex_base;
+	vec2 position = texelFetch(positions, v).rg;
+	float code = texelFetch(colors, v).r;
+
+	int flags = int(t2.z) & 15;
+	int group = int(t2.z) >> 4;
+	vec4 g0 = texelFetch(groups, group * 2);
+	vec4 g1 = texelFetch(groups, group * 2 + 1);
+	mat2 group_m = mat2(g0.xy, g0.zw);
+	mat3x2 world_m = mat3x2(group_m * t0.xy, group_m * t0.zw, group_m * t1.xy + g1.xy);
+	if ((flags & 8) != 0) { world_m[2] += drag; }
+	vec2 barycenter = t1.zw;
+	float phase = t2.x;
+	float anim = t2.y;
+	int is_ith_triangle = flags & 1;
+
+	int q = int(phase) & 3; // phase class
+	vec3 color = (tint.a != 0.0) ? tint.rgb : palette[clamp(int(code) + 1, 0, 10)];
+	if (is_ith_triangle == 1) { color *= 1 - 0.4 * pulse[q]; }
+
+	if ((flags & 2) != 0) { color = vec3(0.05, 0.49, 0.82); } // clicked, as fragment_shader.glsl does
+
+	vec4 world = vec4(world_m * vec3(position, 1.0), 0.0, 1.0);
+	// One lookup in the animation table of the frame, about the world barycenter, or the
+	// model barycenter for type 7. It is the identity out of the animation mode.
+	int entry = (clamp(int(anim), 0, 7) * 4 + q) * 2;
+	vec2 pivot = (anim == 7.0) ? barycenter : world_m * vec3(barycenter, 1.0);
+	vec2 moved = mat2(motion[entry]) * (world.xy - pivot) + pivot + motion[entry + 1].xy;
+	gl_Position = view * vec4(moved, 0.0, 1.0);
+	f_color = color;
+
+	gl_Position.z = t2.w * gl_Position.w;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 150 core
+
+// The clusters of small triangles, see ViewCuller: a square per cluster, two triangles with
+// the color of the cluster at every corner. The depth is that of its top triangle, as the
+// batched triangles carry theirs (see vertex_shader_batched.glsl), so it goes under the
+// triangles drawn above it.
+in vec3 position;      // x,y in world space, then depth
+in vec3 cluster_color; // r,g,b
+out vec3 f_color;
+
+// palette and the Frame block (view, time, animated, pulse, motion): see shader_prelude in Animation.h.
+
+void main()
+{
+	gl_Position = view * vec4(position.xy, 0.0, 1.0);
+	gl_Position.z = position.z * gl_Position.w;
+	f_color = cluster_color;
+}